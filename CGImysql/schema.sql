@@ -0,0 +1,11 @@
+-- 新建数据库时使用：建库建表，username上带唯一索引
+-- mysql -u root -p < CGImysql/schema.sql
+
+CREATE DATABASE IF NOT EXISTS mywebdb;
+USE mywebdb;
+
+CREATE TABLE IF NOT EXISTS user (
+    username char(50) NULL,
+    passwd char(50) NULL,
+    UNIQUE KEY username (username)
+) ENGINE=InnoDB;
@@ -0,0 +1,666 @@
+#ifndef SQL_ASYNC_H
+#define SQL_ASYNC_H
+
+// 非阻塞接口（mysql_*_start/mysql_*_cont）只有MariaDB Connector/C提供，用make ASYNC_DB=1编译时启用
+#ifdef ASYNC_DB
+
+#include <mysql/mysql.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <time.h>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../lock/locker.h"
+#include "../log/log.h"
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+// 非阻塞数据库客户端的统计
+struct sql_async_stats {
+    int conns;              // 可用的连接数
+    int busy;               // 正在执行语句的连接数
+    int queued;             // 等待空闲连接的操作数
+    long long done;         // 已完成的操作数
+    long long failed;       // 执行出错的操作数
+    long long batches;      // 合并执行的多行插入语句数
+    long long batched;      // 其中插入的用户数
+    long long reconnects;   // 断开的连接重新建立的次数
+    long long reconnect_failures; // 重新建立失败的次数
+};
+
+/**
+ * @brief 事件循环中的非阻塞数据库客户端
+ *
+ * 启动时建立若干个非阻塞连接并准备好预编译语句，之后语句用mysql_stmt_*_start/_cont分步执行：
+ * 需要等待数据库时返回要等待的事件，连接的socket注册在事件循环的epoll中，事件到达后继续执行。
+ * 工作线程提交操作后立即返回，请求挂起时不占用工作线程；操作完成后在事件循环线程中调用
+ * T::db_done把结果交给请求，由请求生成响应。
+ *
+ * 除submit外的成员函数只在事件循环线程中调用。工作线程提交的操作放入加锁的队列，
+ * 再通过eventfd唤醒事件循环，由空闲的连接依次取出执行。注册同时只有一条插入在执行，
+ * 执行期间到达的注册排队，之后合并成一条多行插入，一次往返、一次提交写入多个用户。
+ * 合并插入因为同名用户失败时逐个重试，这依赖username上的唯一索引；没有唯一索引时提交插入前
+ * 必须已查询确认用户名没有被占用（见http_conn.cpp的need_confirm）。
+ *
+ * 启动时连不上的、执行中断开的和空闲时被服务端关闭的连接交给后台线程重新建立（建立连接和准备语句
+ * 是阻塞的，不放在事件循环中），建好后通过eventfd交回事件循环；数据库不可用时每RETRY_INTERVAL_MS重试一次。
+ * 没有可用连接时提交的操作立即以失败结束，不会挂起到超时。
+ */
+template <typename T>
+class sql_async {
+public:
+    static const int MAX_PARAMS = 2;
+    static const int VALUE_LEN = 100;
+
+    // 一次数据库操作，参数复制到这里，请求在等待期间被关闭或复用也不受影响
+    struct op {
+        T* req;
+        unsigned int seq;                       // 提交时请求的序号，请求据此判断结果是否仍属于自己
+        int stmt;                               // 语句编号，见sql_stmt
+        int nparams;
+        char params[MAX_PARAMS][VALUE_LEN];
+        unsigned long lens[MAX_PARAMS];
+        bool alone;                             // 不与其他插入合并，合并执行遇到重复用户名后逐个重新执行时设置
+    };
+
+    // 数据库不可用时两次重连之间的最小间隔（毫秒），与连接池相同
+    static const int RETRY_INTERVAL_MS = 1000;
+
+    sql_async(int close_log, int max_pending = 10000)
+        : m_close_log(close_log), m_max_pending(max_pending), m_epollfd(-1), m_eventfd(-1),
+          m_live(0), m_busy(0), m_done(0), m_failed(0), m_inserting(false), m_batches(0), m_batched(0),
+          m_stop(false), m_reopen_started(false), m_reconnects(0), m_reconnect_failures(0) {}
+
+    ~sql_async() {
+        // 先停止重连线程，之后关闭连接不再交给它重连
+        m_open_lock.lock();
+        m_stop = true;
+        m_open_cond.signal();
+        m_open_lock.unlock();
+        if (m_reopen_started) {
+            pthread_join(m_reopen, nullptr);
+        }
+        for (size_t i = 0; i < m_opened.size(); i++) {
+            release(*m_opened[i].second);
+            delete m_opened[i].second;
+        }
+        for (size_t i = 0; i < m_slots.size(); i++) {
+            close_slot(m_slots[i]);
+        }
+        if (m_eventfd >= 0) {
+            close(m_eventfd);
+        }
+    }
+
+    // 建立conn_num个非阻塞连接并准备语句，在启动时阻塞完成；连不上的交给后台线程稍后重连，不退出
+    // 第一个连接在本线程建立，其余每个连接一个线程同时建立
+    void init(string url, string user, string passwd, string db, int port, int conn_num) {
+        m_url = url;
+        m_user = user;
+        m_passwd = passwd;
+        m_db = db;
+        m_port = port;
+        m_slots.resize(conn_num);
+        vector<open_arg> args(conn_num);
+        vector<pthread_t> tids(conn_num);
+        for (int i = 0; i < conn_num; i++) {
+            args[i].self = this;
+            args[i].s = &m_slots[i];
+            args[i].started = i > 0 && pthread_create(&tids[i], nullptr, open_worker, &args[i]) == 0;
+            if (!args[i].started) {
+                args[i].ok = open_slot(m_slots[i]);
+            }
+        }
+        int failed = 0;
+        for (int i = 0; i < conn_num; i++) {
+            if (args[i].started) {
+                pthread_join(tids[i], nullptr);
+            }
+            if (!args[i].ok) {
+                release(m_slots[i]);
+                m_to_open.push_back(i);
+                failed++;
+            }
+        }
+        if (failed) {
+            LOG_ERROR("async db: %d of %d connections failed, retrying in background", failed, conn_num);
+        }
+        m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_eventfd < 0) {
+            LOG_ERROR("%s", "eventfd failure");
+            exit(1);
+        }
+        m_reopen_started = pthread_create(&m_reopen, nullptr, reopen_worker, this) == 0;
+        if (!m_reopen_started) {
+            LOG_ERROR("%s", "failed to start async db reconnect thread");
+        }
+    }
+
+    // 把连接的socket和唤醒用的eventfd注册到事件循环的epoll中
+    // 空闲连接不关注任何事件，服务端关闭连接时仍会收到EPOLLHUP/EPOLLERR
+    void attach(int epollfd) {
+        m_epollfd = epollfd;
+        epoll_event event;
+        event.data.fd = m_eventfd;
+        event.events = EPOLLIN;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_eventfd, &event);
+        for (size_t i = 0; i < m_slots.size(); i++) {
+            if (m_slots[i].mysql) {
+                watch_new(m_slots[i]);
+            }
+        }
+    }
+
+    /**
+     * 提交一次数据库操作，工作线程调用，不等待执行
+     * @param req 完成后接收结果的请求
+     * @param seq 请求当前的序号，原样交给T::db_done
+     * @param stmt 语句编号
+     * @param p0, p1 语句的字符串参数，没有的传nullptr，超长的部分截断
+     * @return 等待的操作过多时返回false，请求应当回复错误
+     */
+    bool submit(T* req, unsigned int seq, int stmt, const char* p0, const char* p1) {
+        op o;
+        o.req = req;
+        o.seq = seq;
+        o.stmt = stmt;
+        o.nparams = 0;
+        o.alone = false;
+        const char* params[MAX_PARAMS] = {p0, p1};
+        for (int i = 0; i < MAX_PARAMS && params[i]; i++) {
+            o.lens[i] = strnlen(params[i], VALUE_LEN - 1);
+            memcpy(o.params[i], params[i], o.lens[i]);
+            o.params[i][o.lens[i]] = '\0';
+            o.nparams++;
+        }
+        m_lock.lock();
+        if ((int)m_queue.size() >= m_max_pending) {
+            m_lock.unlock();
+            return false;
+        }
+        m_queue.push_back(o);
+        m_lock.unlock();
+        uint64_t one = 1;
+        ssize_t n = write(m_eventfd, &one, sizeof(one));
+        (void)n;
+        return true;
+    }
+
+    // fd是否为本客户端的连接或eventfd，事件循环据此把事件交给handle
+    bool owns(int fd) const {
+        return fd == m_eventfd || find(fd) >= 0;
+    }
+
+    // 处理fd上的事件：eventfd可读时取回重新建立的连接、取出新提交的操作，连接可读写时继续执行其上的语句
+    void handle(int fd, unsigned int events) {
+        if (fd == m_eventfd) {
+            uint64_t count;
+            ssize_t n = read(m_eventfd, &count, sizeof(count));
+            (void)n;
+            adopt();
+            dispatch();
+            return;
+        }
+        int i = find(fd);
+        slot& s = m_slots[i];
+        if (!s.busy) {
+            // 空闲时连接上不应有事件，只可能是服务端关闭了连接
+            LOG_ERROR("async db connection %d closed by server", i);
+            close_slot(s);
+            dispatch();
+            return;
+        }
+        int ready = 0;
+        if (events & EPOLLIN) {
+            ready |= MYSQL_WAIT_READ;
+        }
+        if (events & EPOLLOUT) {
+            ready |= MYSQL_WAIT_WRITE;
+        }
+        if (events & EPOLLPRI) {
+            ready |= MYSQL_WAIT_EXCEPT;
+        }
+        // 出错时让客户端库继续读写，由它返回具体的错误
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            ready |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE;
+        }
+        run(s, ready);
+        dispatch();
+    }
+
+    void get_stats(sql_async_stats& st) {
+        st.conns = m_live;
+        st.busy = m_busy;
+        m_lock.lock();
+        st.queued = m_queue.size();
+        m_lock.unlock();
+        st.done = m_done;
+        st.failed = m_failed;
+        st.batches = m_batches;
+        st.batched = m_batched;
+        m_open_lock.lock();
+        st.reconnects = m_reconnects;
+        st.reconnect_failures = m_reconnect_failures;
+        m_open_lock.unlock();
+    }
+
+private:
+    enum phase {
+        PHASE_EXECUTE,      // 执行语句
+        PHASE_STORE         // 取回结果集
+    };
+
+    // 一个非阻塞连接，参数和结果的绑定指向本结构中的缓冲区，执行期间不能移动
+    struct slot {
+        MYSQL* mysql;
+        int fd;
+        MYSQL_STMT* stmts[SQL_STMT_COUNT];
+        bool busy;
+        int phase;
+        unsigned int events;                    // 当前在epoll中关注的事件
+        op ops[SQL_INSERT_MAX_ROWS];            // 正在执行的操作，合并的插入有多个，其他只有一个
+        int nops;
+        int stmt;                               // 实际执行的语句，合并的插入是对应行数的多行插入
+        MYSQL_BIND params[MAX_PARAMS * SQL_INSERT_MAX_ROWS];
+        MYSQL_BIND result;
+        char value[VALUE_LEN];
+        unsigned long value_len;
+    };
+
+    // 启动时并行建立连接的线程参数
+    struct open_arg {
+        sql_async* self;
+        slot* s;
+        bool started;
+        bool ok;
+    };
+
+    static void* open_worker(void* arg) {
+        open_arg* a = (open_arg*)arg;
+        a->ok = a->self->open_slot(*a->s);
+        return nullptr;
+    }
+
+    // 建立一个非阻塞连接并准备所有语句，失败时记录日志并返回false，已分配的由release释放
+    bool open_slot(slot& s) {
+        memset(s.stmts, 0, sizeof(s.stmts));
+        s.busy = false;
+        s.events = 0;
+        s.mysql = mysql_init(nullptr);
+        if (s.mysql == nullptr) {
+            LOG_ERROR("%s", "MySQL Error");
+            return false;
+        }
+        unsigned int timeout = connection_pool::CONNECT_TIMEOUT_S;
+        mysql_options(s.mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+        mysql_options(s.mysql, MYSQL_OPT_NONBLOCK, 0);
+        if (!mysql_real_connect(s.mysql, m_url.c_str(), m_user.c_str(), m_passwd.c_str(), m_db.c_str(), m_port, nullptr, 0)) {
+            LOG_ERROR("MySQL Error: %s", mysql_error(s.mysql));
+            return false;
+        }
+        for (int id = 0; id < SQL_STMT_COUNT; id++) {
+            s.stmts[id] = mysql_stmt_init(s.mysql);
+            if (s.stmts[id] == nullptr || mysql_stmt_prepare(s.stmts[id], sql_stmt_text(id), strlen(sql_stmt_text(id)))) {
+                LOG_ERROR("mysql_stmt_prepare error: %s", mysql_error(s.mysql));
+                return false;
+            }
+        }
+        s.fd = mysql_get_socket(s.mysql);
+        return true;
+    }
+
+    // 关闭连接上的语句和连接本身，不涉及epoll
+    static void release(slot& s) {
+        if (!s.mysql) {
+            return;
+        }
+        for (int id = 0; id < SQL_STMT_COUNT; id++) {
+            if (s.stmts[id]) {
+                mysql_stmt_close(s.stmts[id]);
+                s.stmts[id] = nullptr;
+            }
+        }
+        mysql_close(s.mysql);
+        s.mysql = nullptr;
+    }
+
+    // 把空闲的连接注册到epoll中，不关注任何事件，只接收服务端关闭连接时的EPOLLHUP/EPOLLERR
+    void watch_new(slot& s) {
+        epoll_event event;
+        event.data.fd = s.fd;
+        event.events = 0;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, s.fd, &event);
+        s.events = 0;
+        m_live++;
+    }
+
+    // 后台重连线程：依次重新建立断开的连接，建好的放入m_opened并唤醒事件循环取回，
+    // 失败的放回队尾，等待RETRY_INTERVAL_MS后再试
+    static void* reopen_worker(void* arg) {
+        ((sql_async*)arg)->reopen_loop();
+        return nullptr;
+    }
+
+    void reopen_loop() {
+        m_open_lock.lock();
+        while (!m_stop) {
+            if (m_to_open.empty()) {
+                m_open_cond.wait(m_open_lock.get());
+                continue;
+            }
+            int i = m_to_open.front();
+            m_to_open.pop_front();
+            m_open_lock.unlock();
+
+            slot* fresh = new slot;
+            bool ok = open_slot(*fresh);
+            if (!ok) {
+                release(*fresh);
+                delete fresh;
+            }
+
+            m_open_lock.lock();
+            if (ok) {
+                m_opened.push_back(make_pair(i, fresh));
+                m_reconnects++;
+                uint64_t one = 1;
+                ssize_t n = write(m_eventfd, &one, sizeof(one));
+                (void)n;
+                continue;
+            }
+            m_reconnect_failures++;
+            m_to_open.push_back(i);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += RETRY_INTERVAL_MS / 1000;
+            deadline.tv_nsec += (RETRY_INTERVAL_MS % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (!m_stop && m_open_cond.timewait(m_open_lock.get(), deadline)) {
+            }
+        }
+        m_open_lock.unlock();
+    }
+
+    // 在事件循环线程中取回后台线程重新建立的连接，放回原来的位置
+    void adopt() {
+        m_open_lock.lock();
+        vector<pair<int, slot*> > opened;
+        opened.swap(m_opened);
+        m_open_lock.unlock();
+        for (size_t k = 0; k < opened.size(); k++) {
+            slot& s = m_slots[opened[k].first];
+            slot* fresh = opened[k].second;
+            s.mysql = fresh->mysql;
+            s.fd = fresh->fd;
+            memcpy(s.stmts, fresh->stmts, sizeof(s.stmts));
+            s.busy = false;
+            delete fresh;
+            watch_new(s);
+            LOG_INFO("async db connection %d reconnected", opened[k].first);
+        }
+    }
+
+    int find(int fd) const {
+        for (size_t i = 0; i < m_slots.size(); i++) {
+            if (m_slots[i].mysql && m_slots[i].fd == fd) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    static void bind_string(MYSQL_BIND* bind, char* buf, unsigned long size, unsigned long* len) {
+        memset(bind, 0, sizeof(*bind));
+        bind->buffer_type = MYSQL_TYPE_STRING;
+        bind->buffer = buf;
+        bind->buffer_length = size;
+        bind->length = len;
+    }
+
+    // 把排队的操作交给空闲的连接；没有可用连接时排队的操作全部以失败结束
+    void dispatch() {
+        for (size_t i = 0; i < m_slots.size(); i++) {
+            slot& s = m_slots[i];
+            if (!s.mysql || s.busy) {
+                continue;
+            }
+            m_lock.lock();
+            // 同时只执行一条插入：已有插入在执行时注册留在队列中，其他操作照常取出
+            typename deque<op>::iterator first = m_queue.begin();
+            while (first != m_queue.end() && m_inserting && SQL_INSERT_USER == first->stmt) {
+                ++first;
+            }
+            if (first == m_queue.end()) {
+                m_lock.unlock();
+                return;
+            }
+            s.ops[0] = *first;
+            m_queue.erase(first);
+            s.nops = 1;
+            if (SQL_INSERT_USER == s.ops[0].stmt) {
+                m_inserting = true;
+            }
+            // 执行期间排队的注册一起取出，用一条多行插入执行
+            if (SQL_INSERT_USER == s.ops[0].stmt && !s.ops[0].alone) {
+                for (typename deque<op>::iterator it = m_queue.begin(); it != m_queue.end() && s.nops < SQL_INSERT_MAX_ROWS; ) {
+                    if (SQL_INSERT_USER == it->stmt && !it->alone) {
+                        s.ops[s.nops++] = *it;
+                        it = m_queue.erase(it);
+                    }
+                    else {
+                        ++it;
+                    }
+                }
+            }
+            m_lock.unlock();
+            s.stmt = SQL_INSERT_USER == s.ops[0].stmt ? sql_insert_stmt(s.nops) : s.ops[0].stmt;
+            start(s);
+        }
+        if (0 == m_live) {
+            m_lock.lock();
+            deque<op> failed;
+            failed.swap(m_queue);
+            m_lock.unlock();
+            for (size_t i = 0; i < failed.size(); i++) {
+                m_failed++;
+                failed[i].req->db_done(failed[i], false, nullptr, 0);
+            }
+        }
+    }
+
+    void start(slot& s) {
+        s.busy = true;
+        m_busy++;
+        int n = 0;
+        for (int k = 0; k < s.nops; k++) {
+            op& o = s.ops[k];
+            for (int i = 0; i < o.nparams; i++) {
+                bind_string(&s.params[n++], o.params[i], o.lens[i], &o.lens[i]);
+            }
+        }
+        if (mysql_stmt_bind_param(s.stmts[s.stmt], s.params)) {
+            finish(s, false);
+            return;
+        }
+        s.phase = PHASE_EXECUTE;
+        run(s, 0);
+    }
+
+    // 推进连接上的语句，ready为0表示开始当前阶段，否则是已就绪的事件
+    // 客户端库要等待时注册它要的事件后返回；连接上没有设置读写超时，不会要求等待MYSQL_WAIT_TIMEOUT
+    void run(slot& s, int ready) {
+        MYSQL_STMT* stmt = s.stmts[s.stmt];
+        while (true) {
+            int ret = 0;
+            int status;
+            if (PHASE_EXECUTE == s.phase) {
+                status = ready ? mysql_stmt_execute_cont(&ret, stmt, ready) : mysql_stmt_execute_start(&ret, stmt);
+            }
+            else {
+                status = ready ? mysql_stmt_store_result_cont(&ret, stmt, ready) : mysql_stmt_store_result_start(&ret, stmt);
+            }
+            if (status) {
+                unsigned int events = 0;
+                if (status & MYSQL_WAIT_READ) {
+                    events |= EPOLLIN;
+                }
+                if (status & MYSQL_WAIT_WRITE) {
+                    events |= EPOLLOUT;
+                }
+                if (status & MYSQL_WAIT_EXCEPT) {
+                    events |= EPOLLPRI;
+                }
+                watch(s, events);
+                return;
+            }
+            if (ret) {
+                finish(s, false);
+                return;
+            }
+            // 语句执行完，有结果集时接着取回结果
+            if (PHASE_EXECUTE == s.phase && mysql_stmt_field_count(stmt) > 0) {
+                s.value_len = 0;
+                bind_string(&s.result, s.value, sizeof(s.value), &s.value_len);
+                if (mysql_stmt_bind_result(stmt, &s.result)) {
+                    finish(s, false);
+                    return;
+                }
+                s.phase = PHASE_STORE;
+                ready = 0;
+                continue;
+            }
+            finish(s, true);
+            return;
+        }
+    }
+
+    void watch(slot& s, unsigned int events) {
+        if (s.events == events) {
+            return;
+        }
+        epoll_event event;
+        event.data.fd = s.fd;
+        event.events = events;
+        epoll_ctl(m_epollfd, EPOLL_CTL_MOD, s.fd, &event);
+        s.events = events;
+    }
+
+    // 结果集已全部取回，取第一行和释放结果都不访问网络
+    void finish(slot& s, bool ok) {
+        MYSQL_STMT* stmt = s.stmts[s.stmt];
+        const char* value = nullptr;
+        unsigned long len = 0;
+        bool lost = false;
+        bool retry = false;
+        if (!ok) {
+            unsigned int err = mysql_stmt_errno(stmt);
+            LOG_ERROR("async db error: %s", mysql_stmt_error(stmt));
+            lost = (CR_SERVER_GONE_ERROR == err || CR_SERVER_LOST == err);
+            // 合并的插入因为其中的同名用户整条失败（只在有唯一索引时出现），逐个重新执行，每个请求得到自己的结果
+            retry = s.nops > 1 && ER_DUP_ENTRY == err;
+        }
+        else if (PHASE_STORE == s.phase) {
+            int ret = mysql_stmt_fetch(stmt);
+            if (0 == ret || MYSQL_DATA_TRUNCATED == ret) {
+                value = s.value;
+                len = s.value_len < sizeof(s.value) ? s.value_len : sizeof(s.value);
+            }
+            mysql_stmt_free_result(stmt);
+        }
+        if (SQL_INSERT_USER == s.ops[0].stmt) {
+            m_inserting = false;
+        }
+        if (s.nops > 1) {
+            m_batches++;
+            m_batched += s.nops;
+        }
+        watch(s, 0);
+        s.busy = false;
+        m_busy--;
+        if (retry) {
+            m_lock.lock();
+            for (int k = s.nops - 1; k >= 0; k--) {
+                s.ops[k].alone = true;
+                m_queue.push_front(s.ops[k]);
+            }
+            m_lock.unlock();
+        }
+        else {
+            for (int k = 0; k < s.nops; k++) {
+                if (ok) {
+                    m_done++;
+                }
+                else {
+                    m_failed++;
+                }
+                s.ops[k].req->db_done(s.ops[k], ok, value, len);
+            }
+        }
+        if (lost) {
+            close_slot(s);
+        }
+    }
+
+    // 关闭断开的连接，交给后台线程重新建立
+    void close_slot(slot& s) {
+        if (!s.mysql) {
+            return;
+        }
+        if (m_epollfd >= 0) {
+            epoll_ctl(m_epollfd, EPOLL_CTL_DEL, s.fd, 0);
+            m_live--;
+        }
+        release(s);
+        m_open_lock.lock();
+        if (!m_stop) {
+            m_to_open.push_back(&s - &m_slots[0]);
+            m_open_cond.signal();
+        }
+        m_open_lock.unlock();
+    }
+
+    int m_close_log;
+    string m_url;               // 数据库地址、用户、密码、库名和端口
+    string m_user;
+    string m_passwd;
+    string m_db;
+    int m_port;
+    int m_max_pending;          // 排队的操作数上限
+    int m_epollfd;
+    int m_eventfd;              // 工作线程提交操作后唤醒事件循环
+    vector<slot> m_slots;
+    locker m_lock;              // 保护m_queue
+    deque<op> m_queue;          // 等待空闲连接的操作
+    int m_live;                 // 可用的连接数
+    int m_busy;
+    long long m_done;
+    long long m_failed;
+    bool m_inserting;           // 是否有插入正在执行
+    long long m_batches;
+    long long m_batched;
+
+    locker m_open_lock;         // 保护以下成员
+    cond m_open_cond;           // 有连接需要重连或要求退出
+    deque<int> m_to_open;       // 等待重连的连接
+    vector<pair<int, slot*> > m_opened; // 已重新建立、等待事件循环取回的连接
+    bool m_stop;                // 要求重连线程退出
+    bool m_reopen_started;
+    pthread_t m_reopen;         // 重连线程
+    long long m_reconnects;
+    long long m_reconnect_failures;
+};
+
+#endif
+
+#endif
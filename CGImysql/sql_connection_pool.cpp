@@ -1,13 +1,73 @@
 #include "sql_connection_pool.h"
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
 
 using namespace std;
 
+// 生成各预编译语句的文本，多行插入的VALUES部分按插入的用户数重复
+static vector<string> build_stmt_text() {
+    vector<string> text;
+    text.push_back("SELECT passwd FROM user WHERE username = ?");
+    text.push_back("INSERT INTO user (username, passwd) VALUES (?, ?)");
+    text.push_back("SELECT passwd FROM user WHERE username = ?");
+    for (int n = 2; n <= SQL_INSERT_MAX_ROWS; n++) {
+        string sql = "INSERT INTO user (username, passwd) VALUES (?, ?)";
+        for (int i = 1; i < n; i++) {
+            sql += ", (?, ?)";
+        }
+        text.push_back(sql);
+    }
+    return text;
+}
+
+// 预编译语句的文本，下标为sql_stmt中的编号
+const char* sql_stmt_text(int id) {
+    static const vector<string> text = build_stmt_text();
+    return text[id].c_str();
+}
+
+// 连接池中的一个连接。MYSQL放在开头，对外仍以MYSQL*表示，需要时转换回来；
+// 连接结构由连接池分配，重连时在原处重新初始化，连接的指针保持不变
+struct connection_pool::pooled_conn {
+    MYSQL mysql;
+    MYSQL_STMT* stmts[SQL_STMT_COUNT];  // 连接上缓存的预编译语句，只由持有连接的线程访问
+    long long last_used_ms;             // 最近一次被请求使用的时间，空闲过久的多余连接被关闭
+    long long checked_ms;               // 最近一次确认连接可用的时间（使用、ping或重连），空闲过久的先ping
+    long long retry_ms;                 // 断开时下一次允许重连的时间
+    bool broken;                        // 连接已断开或没有连上
+};
+
+connection_pool::pooled_conn* connection_pool::to_pooled(MYSQL* con) {
+    return reinterpret_cast<pooled_conn*>(con);
+}
+
+// 单调时钟的当前时间（毫秒）
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 // 构造函数
 connection_pool::connection_pool() {
     // 初始化当前连接数和空闲连接数为0
+    m_MinConn = 0;
+    m_MaxConn = 0;
+    m_TotalConn = 0;
     m_CurConn = 0;
     m_FreeConn = 0;
+    m_grow_retry_ms = 0;
+    m_stop = false;
+    m_health_started = false;
+    memset(&m_stats, 0, sizeof(m_stats));
 }
 
 // 单例模式获取connection_pool的实例
@@ -19,68 +79,168 @@ connection_pool *connection_pool::GetInstance() {
 }
 
 // 初始化连接池
-void connection_pool::init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log ) {
+void connection_pool::init(string url, string User, string PassWord, string DataBaseName, int Port, int MinConn, int close_log, int MaxConn) {
     // 设置数据库连接参数
     m_url = url;
-    m_Port = Port;
+    m_Port = to_string(Port);
     m_User = User;
     m_PassWord = PassWord;
     m_DatabaseName = DataBaseName;
     m_close_log = close_log;
+    m_MinConn = MinConn;
+    m_MaxConn = MaxConn > MinConn ? MaxConn : MinConn;
 
-    // 创建并初始化数据库连接
-    for (int i = 0; i < MaxConn; i++) {
-        MYSQL* con = nullptr;
-        // 初始化MySQL连接
-        con = mysql_init(con);
-        if (con == nullptr) {
-            // 初始化失败，记录错误并退出
-            LOG_ERROR("MySQL Error");
-            exit(1);
+    // 创建并初始化数据库连接。第一个连接在本线程建立，同时完成客户端库的初始化（不是线程安全的），
+    // 其余的每个连接一个线程同时建立，启动时间不再随连接数增长
+    vector<connect_arg> args(MinConn > 0 ? MinConn : 0);
+    vector<pthread_t> tids(args.size());
+    vector<bool> started(args.size(), false);
+    for (size_t i = 0; i < args.size(); i++) {
+        args[i].pool = this;
+        args[i].pc = nullptr;
+        if (i == 0 || pthread_create(&tids[i], nullptr, connect_worker, &args[i]) != 0) {
+            args[i].pc = Connect();
         }
-        // 尝试建立与数据库的连接
-        con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DataBaseName.c_str(), Port, nullptr, 0);
-        if (con == nullptr) {
-            // 连接失败，记录错误并退出
-            LOG_ERROR("MySQL Error");
-            exit(1);
+        else {
+            started[i] = true;
+        }
+    }
+    // 连不上的也放入连接池，之后重连
+    int failed = 0;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (started[i]) {
+            pthread_join(tids[i], nullptr);
+        }
+        if (args[i].pc->broken) {
+            failed++;
         }
         // 将连接添加到连接列表中
-        connList.push_back(con);
+        connList.push_back(&args[i].pc->mysql);
         // 增加空闲连接数
         ++m_FreeConn;
+        ++m_TotalConn;
+    }
+    if (failed > 0) {
+        LOG_ERROR("MySQL Error: %d of %d connections failed, will retry", failed, MinConn);
     }
-    // 初始化信号量，用于控制连接的使用
-    reserve = sem(m_FreeConn);
 
-    // 设置最大连接数
-    m_MaxConn = m_FreeConn;
+    // 启动后台检查线程
+    if (pthread_create(&m_health, nullptr, health_worker, this) == 0) {
+        m_health_started = true;
+    }
+}
+
+connection_pool::pooled_conn* connection_pool::Connect() {
+    pooled_conn* pc = new pooled_conn;
+    memset(pc->stmts, 0, sizeof(pc->stmts));
+    pc->last_used_ms = now_ms();
+    pc->checked_ms = pc->last_used_ms;
+    pc->retry_ms = 0;
+    pc->broken = false;
+    // 初始化MySQL连接
+    mysql_init(&pc->mysql);
+    unsigned int timeout = CONNECT_TIMEOUT_S;
+    mysql_options(&pc->mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    // 尝试建立与数据库的连接
+    if (mysql_real_connect(&pc->mysql, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(),
+                           atoi(m_Port.c_str()), nullptr, 0) == nullptr) {
+        LOG_ERROR("MySQL connect error: %s", mysql_error(&pc->mysql));
+        pc->broken = true;
+        pc->retry_ms = pc->last_used_ms + RETRY_INTERVAL_MS;
+    }
+    return pc;
+}
+
+void* connection_pool::connect_worker(void* arg) {
+    connect_arg* a = (connect_arg*)arg;
+    a->pc = a->pool->Connect();
+    return nullptr;
+}
+
+void connection_pool::Close(pooled_conn* pc) {
+    // 先关闭连接上缓存的预编译语句
+    for (int i = 0; i < SQL_STMT_COUNT; i++) {
+        DropStatement(&pc->mysql, i);
+    }
+    // 关闭数据库连接
+    mysql_close(&pc->mysql);
+    delete pc;
 }
 
 //当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
 MYSQL* connection_pool::GetConnection() {
     MYSQL* con = nullptr;
-
-    // 如果连接池中没有可用连接，直接返回空指针
-    if (0 == connList.size()) {
-        return nullptr;
+    long long start = now_us();
+    bool waited = false;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ACQUIRE_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (ACQUIRE_TIMEOUT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
     }
-    // 等待有可用连接
-    reserve.wait();
 
     // 加锁以保护共享资源
     lock.lock();
+    while (connList.empty()) {
+        // 没有空闲连接且未达到上限时新建一个，建立连接期间不持有锁
+        if (m_TotalConn < m_MaxConn && now_ms() >= m_grow_retry_ms) {
+            ++m_TotalConn;
+            lock.unlock();
+            pooled_conn* pc = Connect();
+            lock.lock();
+            if (!pc->broken) {
+                ++m_CurConn;
+                m_stats.grows++;
+                con = &pc->mysql;
+                break;
+            }
+            // 数据库不可用，暂停新建，继续等待已有的连接
+            --m_TotalConn;
+            m_grow_retry_ms = now_ms() + RETRY_INTERVAL_MS;
+            lock.unlock();
+            Close(pc);
+            lock.lock();
+            continue;
+        }
+        waited = true;
+        if (!m_cond.timewait(lock.get(), deadline) && connList.empty()) {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+                m_stats.timeouts++;
+                lock.unlock();
+                LOG_ERROR("%s", "MySQL Error: no free connection");
+                return nullptr;
+            }
+        }
+    }
 
-    // 获取连接池的第一个连接
-    con = connList.front();
-    // 从连接池中移除该连接
-    connList.pop_front();
-    // 更新可用连接数量
-    --m_FreeConn;
-    // 更新当前连接数量
-    ++m_CurConn;
+    if (con == nullptr) {
+        // 获取连接池的第一个连接
+        con = connList.front();
+        // 从连接池中移除该连接
+        connList.pop_front();
+        // 更新可用连接数量
+        --m_FreeConn;
+        // 更新当前连接数量
+        ++m_CurConn;
+    }
+    m_stats.acquires++;
+    if (waited) {
+        long long wait_us = now_us() - start;
+        m_stats.waits++;
+        m_stats.wait_total_us += wait_us;
+        if (wait_us > m_stats.wait_max_us) {
+            m_stats.wait_max_us = wait_us;
+        }
+    }
     // 解锁以释放共享资源
     lock.unlock();
+
+    Validate(to_pooled(con), false);
+    to_pooled(con)->last_used_ms = now_ms();
     // 返回获取的连接
     return con;
 }
@@ -88,11 +248,12 @@ MYSQL* connection_pool::GetConnection() {
 //释放当前使用的连接
 /**
  * 释放数据库连接
- * 
+ *
  * 该函数将一个数据库连接返回到连接池中。它首先检查连接是否为nullptr，
  * 如果不为nullptr，则将连接添加到连接列表中，并更新连接池的状态：增加空闲连接数，
- * 减少当前连接数。然后，通过发布信号量来通知等待的线程有可用的连接。
- * 
+ * 减少当前连接数。然后，通过条件变量通知等待的线程有可用的连接。
+ * 使用中断开的连接标记出来，下次取出时重连。
+ *
  * @param con 要释放的数据库连接指针
  * @return 返回true，表示连接已成功释放；如果con为nullptr，则返回false
  */
@@ -101,6 +262,14 @@ bool connection_pool::ReleaseConnection(MYSQL *con) {
     if (nullptr == con) {
         return false;
     }
+    pooled_conn* pc = to_pooled(con);
+    if (IsLost(con)) {
+        pc->broken = true;
+    }
+    pc->last_used_ms = now_ms();
+    if (!pc->broken) {
+        pc->checked_ms = pc->last_used_ms;
+    }
 
     // 加锁以保护连接列表和连接池状态
     lock.lock();
@@ -112,13 +281,127 @@ bool connection_pool::ReleaseConnection(MYSQL *con) {
     // 更新当前连接数
     --m_CurConn;
 
-    // 发布信号量以通知有可用的连接
-    reserve.post();
+    // 解锁，否则下一次获取连接时会一直阻塞
+    lock.unlock();
+
+    // 通知等待的线程有可用的连接
+    m_cond.signal();
     return true;
 }
 
+bool connection_pool::CheckConnection(MYSQL* con) {
+    if (con == nullptr) {
+        return false;
+    }
+    return Validate(to_pooled(con), false);
+}
+
+// force为true时不论空闲多久都ping一次
+bool connection_pool::Validate(pooled_conn* pc, bool force) {
+    MYSQL* con = &pc->mysql;
+    long long now = now_ms();
+    if (!pc->broken && IsLost(con)) {
+        pc->broken = true;
+    }
+    // 空闲较久的连接可能已被服务端关闭，先ping一次
+    if (!pc->broken && (force || now - pc->checked_ms >= VALIDATE_IDLE_MS) && mysql_ping(con)) {
+        pc->broken = true;
+        lock.lock();
+        m_stats.ping_failures++;
+        lock.unlock();
+    }
+    if (pc->broken && now >= pc->retry_ms) {
+        Reconnect(con);
+    }
+    if (!pc->broken) {
+        pc->checked_ms = now;
+    }
+    return !pc->broken;
+}
+
+// 后台检查线程：定期检查空闲的连接，直到连接池销毁
+void* connection_pool::health_worker(void* arg) {
+    connection_pool* pool = (connection_pool*)arg;
+    pool->lock.lock();
+    while (!pool->m_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += HEALTH_INTERVAL_MS / 1000;
+        pool->m_health_cond.timewait(pool->lock.get(), deadline);
+        if (pool->m_stop) {
+            break;
+        }
+        pool->lock.unlock();
+        pool->health_check();
+        pool->lock.lock();
+    }
+    pool->lock.unlock();
+    return nullptr;
+}
+
+// 取出断开的和空闲过久的连接：连接数高于下限时关闭空闲过久的连接，其余ping一次，
+// 断开的重连后放回。检查期间这些连接按借出计算，不会被其他线程取走
+void connection_pool::health_check() {
+    long long now = now_ms();
+    vector<pooled_conn*> check;
+    vector<pooled_conn*> drop;
+    lock.lock();
+    list<MYSQL*>::iterator it = connList.begin();
+    while (it != connList.end()) {
+        pooled_conn* pc = to_pooled(*it);
+        if (!pc->broken && now - pc->checked_ms < PING_IDLE_MS) {
+            ++it;
+            continue;
+        }
+        if (!pc->broken && now - pc->last_used_ms >= SHRINK_IDLE_MS && m_TotalConn > m_MinConn) {
+            drop.push_back(pc);
+            --m_TotalConn;
+            m_stats.shrinks++;
+        }
+        else if (!pc->broken || now >= pc->retry_ms) {
+            check.push_back(pc);
+            ++m_CurConn;
+        }
+        else {
+            ++it;
+            continue;
+        }
+        it = connList.erase(it);
+        --m_FreeConn;
+    }
+    lock.unlock();
+
+    for (size_t i = 0; i < drop.size(); i++) {
+        Close(drop[i]);
+    }
+    for (size_t i = 0; i < check.size(); i++) {
+        Validate(check[i], true);
+    }
+    // 放回时不更新使用时间，没有请求使用的连接仍会因空闲过久被关闭
+    if (!check.empty()) {
+        lock.lock();
+        for (size_t i = 0; i < check.size(); i++) {
+            connList.push_back(&check[i]->mysql);
+        }
+        m_FreeConn += check.size();
+        m_CurConn -= check.size();
+        lock.unlock();
+        m_cond.broadcast();
+    }
+}
+
 // 销毁数据库连接池
 void connection_pool::DestroyPool() {
+    // 先停止后台检查线程
+    lock.lock();
+    m_stop = true;
+    lock.unlock();
+    m_health_cond.signal();
+    if (m_health_started) {
+        pthread_join(m_health, nullptr);
+        m_health_started = false;
+    }
+
     // 加锁以确保线程安全
     lock.lock();
     // 如果连接池中存在数据库连接
@@ -126,13 +409,11 @@ void connection_pool::DestroyPool() {
         // 遍历连接池中的所有连接
         list<MYSQL*>::iterator it;
         for (it = connList.begin(); it != connList.end(); ++it) {
-            // 获取当前迭代的数据库连接指针
-            MYSQL* con = *it;
             // 关闭数据库连接
-            mysql_close(con);
+            Close(to_pooled(*it));
         }
         // 将当前连接数和空闲连接数重置为0
-        m_CurConn = 0;
+        m_TotalConn -= m_FreeConn;
         m_FreeConn = 0;
         // 清空连接池列表
         connList.clear();
@@ -141,12 +422,102 @@ void connection_pool::DestroyPool() {
     lock.unlock();
 }
 
+MYSQL_STMT* connection_pool::GetStatement(MYSQL* con, int id) {
+    if (con == nullptr || id < 0 || id >= SQL_STMT_COUNT) {
+        return nullptr;
+    }
+    MYSQL_STMT*& stmt = to_pooled(con)->stmts[id];
+    if (stmt) {
+        return stmt;
+    }
+    // 第一次使用，在这个连接上准备语句
+    stmt = mysql_stmt_init(con);
+    if (stmt == nullptr) {
+        LOG_ERROR("mysql_stmt_init error: %s", mysql_error(con));
+        return nullptr;
+    }
+    if (mysql_stmt_prepare(stmt, sql_stmt_text(id), strlen(sql_stmt_text(id)))) {
+        LOG_ERROR("mysql_stmt_prepare error: %s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        stmt = nullptr;
+    }
+    return stmt;
+}
+
+void connection_pool::DropStatement(MYSQL* con, int id) {
+    if (con == nullptr || id < 0 || id >= SQL_STMT_COUNT) {
+        return;
+    }
+    MYSQL_STMT*& stmt = to_pooled(con)->stmts[id];
+    if (stmt) {
+        mysql_stmt_close(stmt);
+        stmt = nullptr;
+    }
+}
+
+bool connection_pool::Reconnect(MYSQL* con) {
+    if (con == nullptr) {
+        return false;
+    }
+    pooled_conn* pc = to_pooled(con);
+    // 旧连接上准备的语句随连接一起失效
+    for (int i = 0; i < SQL_STMT_COUNT; i++) {
+        DropStatement(con, i);
+    }
+    mysql_close(con);
+    mysql_init(con);
+    unsigned int timeout = CONNECT_TIMEOUT_S;
+    mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    bool ok = mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(),
+                                 atoi(m_Port.c_str()), nullptr, 0) != nullptr;
+    pc->broken = !ok;
+    // 只有连不上时才推迟下一次重连
+    pc->retry_ms = ok ? 0 : now_ms() + RETRY_INTERVAL_MS;
+    lock.lock();
+    if (ok) {
+        m_stats.reconnects++;
+    }
+    else {
+        m_stats.reconnect_failures++;
+    }
+    lock.unlock();
+    if (!ok) {
+        LOG_ERROR("MySQL reconnect error: %s", mysql_error(con));
+        return false;
+    }
+    LOG_INFO("%s", "MySQL reconnected");
+    return true;
+}
+
+bool connection_pool::IsLost(MYSQL* con) {
+    unsigned int err = mysql_errno(con);
+    return CR_SERVER_GONE_ERROR == err || CR_SERVER_LOST == err;
+}
+
 // 获取当前空闲的数据库连接数
 int connection_pool::GetFreeConn() {
     // 返回当前空闲的数据库连接数
     return this->m_FreeConn;
 }
 
+bool connection_pool::CanGrow() {
+    lock.lock();
+    bool grow = m_TotalConn < m_MaxConn;
+    lock.unlock();
+    return grow;
+}
+
+void connection_pool::get_stats(connection_pool_stats& stats) {
+    lock.lock();
+    stats = m_stats;
+    stats.total = m_TotalConn;
+    stats.free = m_FreeConn;
+    stats.min_conns = m_MinConn;
+    stats.max_conns = m_MaxConn;
+    m_stats.wait_max_us = 0;
+    lock.unlock();
+}
+
 // 析构函数：在对象销毁时调用，用于释放资源
 connection_pool::~connection_pool() {
     // 销毁连接池的所有连接
@@ -157,7 +528,7 @@ connection_pool::~connection_pool() {
 connectionRAII::connectionRAII(MYSQL **SQL, connection_pool* connPool) {
     // 从连接池中获取一个数据库连接指针
     *SQL = connPool->GetConnection();
-    
+
     // 将获取的数据库连接指针赋值给成员变量
     conRAII = *SQL;
     // 将连接池指针赋值给成员变量，用于后续释放连接
@@ -169,4 +540,3 @@ connectionRAII::~connectionRAII() {
     // 将成员变量中的数据库连接指针释放回连接池
     pollRAII->ReleaseConnection(conRAII);
 }
-
@@ -2,9 +2,13 @@
 #define CONNECTION_POOL_H
 
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
 #include <stdio.h>
 #include <list>
 #include <string>
+#include <vector>
+#include <pthread.h>
 
 #include "../lock/locker.h"
 #include "../log/log.h"
@@ -12,6 +16,49 @@
 // 采用命名空间std以简化代码
 using namespace std;
 
+// 合并注册时一条语句最多插入的用户数
+const int SQL_INSERT_MAX_ROWS = 32;
+
+/**
+ * @brief 预编译语句编号
+ *
+ * 语句文本见sql_connection_pool.cpp中的sql_stmt_text，参数都用?占位，以二进制协议执行，
+ * 服务端每个连接只解析一次，参数也不会被当作SQL拼接
+ */
+enum sql_stmt {
+    SQL_SELECT_PASSWD = 0,   // 按用户名查询密码
+    SQL_INSERT_USER,         // 注册新用户
+    SQL_CHECK_USER,          // 注册前确认用户名没有被占用，与SQL_SELECT_PASSWD相同，单独编号以便异步执行完成时区分
+    SQL_INSERT_USERS,        // 一条语句注册多个用户，合并同时到达的注册：编号SQL_INSERT_USERS + n - 2插入n个用户
+    SQL_STMT_COUNT = SQL_INSERT_USERS + SQL_INSERT_MAX_ROWS - 1
+};
+
+// 一条语句插入n个用户（1 <= n <= SQL_INSERT_MAX_ROWS）时的语句编号
+inline int sql_insert_stmt(int n) {
+    return n > 1 ? SQL_INSERT_USERS + n - 2 : SQL_INSERT_USER;
+}
+
+// 各预编译语句的文本，按sql_stmt编号；多行插入的文本在第一次调用时生成
+const char* sql_stmt_text(int id);
+
+// 连接池的运行统计
+struct connection_pool_stats {
+    int total;                  // 连接总数，包括借出的和线程独占的
+    int free;                   // 空闲连接数
+    int min_conns;              // 连接数下限
+    int max_conns;              // 连接数上限
+    long long acquires;         // 取连接的次数
+    long long waits;            // 其中没有空闲连接需要等待的次数
+    long long wait_total_us;    // 等待时间之和
+    long long wait_max_us;      // 最长等待时间，get_stats时清零
+    long long timeouts;         // 等待超时没有取到连接的次数
+    long long grows;            // 等待时新建连接的次数
+    long long shrinks;          // 空闲过久被关闭的连接数
+    long long ping_failures;    // 检查时发现已断开的连接数
+    long long reconnects;       // 重连成功的次数
+    long long reconnect_failures; // 重连失败的次数
+};
+
 /**
  * @brief 数据库连接池类
  * 
@@ -23,9 +70,10 @@ public:
     /**
      * @brief 获取一个空闲的数据库连接
      * 
-     * 从连接池中取出一个空闲的数据库连接供使用。
+     * 从连接池中取出一个空闲的数据库连接供使用。没有空闲连接时，连接数未达到上限则新建一个，
+     * 否则等待其他线程归还，最多等待ACQUIRE_TIMEOUT_MS。取出的连接先经过CheckConnection。
      * 
-     * @return MYSQL* 数据库连接指针
+     * @return MYSQL* 数据库连接指针，等待超时返回nullptr
      */
     MYSQL *GetConnection();
 
@@ -47,6 +95,68 @@ public:
      */
     int GetFreeConn();
 
+    /**
+     * @brief 连接数是否还没有达到上限，即取不到空闲连接时还能新建
+     */
+    bool CanGrow();
+
+    /**
+     * @brief 使用连接前检查连接是否可用
+     *
+     * 上次使用时连接断开，或者空闲超过VALIDATE_IDLE_MS（可能已被服务端按wait_timeout关闭）且ping失败时，
+     * 在原处重连。数据库不可用时每个连接最多每RETRY_INTERVAL_MS重试一次，期间直接使用断开的连接，
+     * 语句很快出错返回，不会让每个请求都等待连接超时。GetConnection取出的连接已经检查过，
+     * 线程独占的连接在每次使用前调用。
+     *
+     * @param conn 当前线程持有的连接
+     * @return 检查后连接是否可用
+     */
+    bool CheckConnection(MYSQL* conn);
+
+    /**
+     * @brief 获取运行统计，同时清零最长等待时间
+     */
+    void get_stats(connection_pool_stats& stats);
+
+    /**
+     * @brief 取得连接上的预编译语句
+     *
+     * 每个连接上的语句第一次使用时准备，之后缓存到连接关闭。连接同一时刻只被一个线程持有，
+     * 缓存不需要加锁。
+     *
+     * @param conn 从连接池取得的数据库连接
+     * @param id 语句编号，见sql_stmt
+     * @return MYSQL_STMT* 准备好的语句，失败时返回nullptr并记录日志
+     */
+    MYSQL_STMT* GetStatement(MYSQL* conn, int id);
+
+    /**
+     * @brief 丢弃连接上缓存的预编译语句
+     *
+     * 语句执行出错后调用（例如连接断开后语句句柄失效），下次使用时重新准备。
+     *
+     * @param conn 数据库连接
+     * @param id 语句编号
+     */
+    void DropStatement(MYSQL* conn, int id);
+
+    /**
+     * @brief 在原处重新建立断开的连接
+     *
+     * 连接的指针不变，缓存的预编译语句全部丢弃，下次使用时重新准备。
+     * 只能由持有该连接的线程调用，失败时连接标记为断开，由CheckConnection稍后重试。
+     *
+     * @param conn 断开的数据库连接
+     * @return true 重连成功
+     * @return false 重连失败，连接保持未连接状态，下次使用时出错后可以再次重连
+     */
+    bool Reconnect(MYSQL* conn);
+
+    /**
+     * @brief 连接上最近一次操作是否因为与服务端断开而失败
+     */
+    static bool IsLost(MYSQL* conn);
+
     /**
      * @brief 销毁连接池
      * 
@@ -66,17 +176,24 @@ public:
     /**
      * @brief 初始化连接池
      * 
-     * 对连接池进行初始化设置，包括数据库服务器地址、用户信息、数据库名、端口、最大连接数等。
+     * 对连接池进行初始化设置，包括数据库服务器地址、用户信息、数据库名、端口、最小和最大连接数等。
+     * 启动时并行建立MinConn个连接，总耗时约为一次建立连接的时间，最多CONNECT_TIMEOUT_S秒。
+     * 连不上的也保留在池中，标记为断开，之后由后台线程或使用时重连，
+     * 数据库暂时不可用不会导致进程退出。同时启动后台检查线程，定期ping空闲较久的连接并关闭多余的空闲连接。
      * 
      * @param url 数据库服务器地址
      * @param User 用户名
      * @param PassWord 密码
      * @param DataBaseName 数据库名
      * @param Port 端口号
-     * @param MaxConn 最大连接数
+     * @param MinConn 最小连接数，启动时建立的连接数
      * @param close_log 关闭日志的标志
+     * @param MaxConn 最大连接数，取连接需要等待时在此范围内新建连接，不大于MinConn时连接数固定
      */
-    void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log);
+    void init(string url, string User, string PassWord, string DataBaseName, int Port, int MinConn, int close_log, int MaxConn = 0);
+
+    // 建立连接的超时时间（秒），数据库不可达时不会长时间阻塞；不经过连接池的连接也用它
+    static const int CONNECT_TIMEOUT_S = 2;
 
 private:
     /**
@@ -89,13 +206,53 @@ private:
      */
     ~connection_pool();
 
+    // 没有空闲连接时最多等待的时间（毫秒）
+    static const int ACQUIRE_TIMEOUT_MS = 3000;
+    // 取出的连接空闲超过该值（毫秒）时先ping一次
+    static const int VALIDATE_IDLE_MS = 10000;
+    // 断开的连接两次重连之间的最小间隔（毫秒），数据库不可用时新建连接也按此间隔暂停
+    static const int RETRY_INTERVAL_MS = 1000;
+    // 后台检查的周期（毫秒）
+    static const int HEALTH_INTERVAL_MS = 5000;
+    // 后台检查时ping空闲超过该值（毫秒）的连接
+    static const int PING_IDLE_MS = 30000;
+    // 连接数高于下限时，关闭空闲超过该值（毫秒）的连接
+    static const int SHRINK_IDLE_MS = 60000;
+
+    struct pooled_conn;
+
+    static pooled_conn* to_pooled(MYSQL* conn);
+    // 新建一个连接，连不上时返回的连接标记为断开
+    pooled_conn* Connect();
+    // 启动时并行建立连接的线程及其参数
+    struct connect_arg {
+        connection_pool* pool;
+        pooled_conn* pc;
+    };
+    static void* connect_worker(void* arg);
+    // 检查并在需要时重连
+    bool Validate(pooled_conn* pc, bool force);
+    // 关闭并释放连接
+    void Close(pooled_conn* pc);
+    // 后台检查线程
+    static void* health_worker(void* arg);
+    void health_check();
+
     // 连接池相关属性和成员变量
+    int m_MinConn;       // 最小连接数
     int m_MaxConn;       // 最大连接数
+    int m_TotalConn;     // 连接总数，包括借出的、线程独占的和正在新建的
     int m_CurConn;       // 当前已使用的连接数
     int m_FreeConn;      // 当前空闲的连接数
     locker lock;         // 锁，用于同步访问连接池
+    cond m_cond;         // 有连接归还时通知等待的线程
+    cond m_health_cond;  // 通知后台检查线程退出
     list<MYSQL*> connList; // 连接列表
-    sem reserve;         // 信号量，用于同步控制连接的获取和释放
+    long long m_grow_retry_ms; // 新建连接失败后，到这个时间之前不再新建
+    bool m_stop;         // 通知后台检查线程退出
+    bool m_health_started;
+    pthread_t m_health;  // 后台检查线程
+    connection_pool_stats m_stats; // 运行统计，由lock保护
 
 public:
     // 以下为数据库连接相关信息，公开成员变量方便访问，实际应用中建议封装
@@ -0,0 +1,173 @@
+#ifndef SQL_GROUP_COMMIT_H
+#define SQL_GROUP_COMMIT_H
+
+#include <mysql/mysql.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+#include "../lock/locker.h"
+#include "../log/log.h"
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+// 合并注册的统计
+struct group_commit_stats {
+    long long batches;      // 写入的批数
+    long long rows;         // 写入的用户数
+    long long failed;       // 其中插入失败的用户数
+    int max_batch;          // 最大的一批
+};
+
+/**
+ * @brief 注册的合并写入（group commit）
+ *
+ * 每个注册各自执行一条INSERT时，数据库每条语句都要一次往返和一次提交。这里把同时到达的注册合并：
+ * 没有正在写入的批时，到达的线程成为写入者，取走队列中的全部注册（最多MAX_BATCH个），
+ * 用自己的连接以一条多行INSERT写入；写入期间到达的注册排队等待，由下一个写入者一起写入。
+ * 负载低时每批只有一个，不额外等待；注册集中到达时一次往返、一次提交写入多个用户。
+ *
+ * 每个注册仍然得到自己的结果：多行INSERT因为其中有重复的用户名出错时，这批用户逐个重新插入，
+ * 其他错误（如连接断开）时这批用户都失败，不重试，避免重复插入。
+ * 由数据库拒绝同名用户只在username有唯一索引（http_conn.cpp中unique_names为真）时成立；没有唯一索引时
+ * 不会出现ER_DUP_ENTRY，同名用户也能插入，这时调用者在插入前必须已查询数据库确认用户名没有被占用（见need_confirm）。
+ * 没有取到连接的线程不排队，只有自己的注册失败，不会成为写入者让整批失败。
+ */
+class group_commit {
+public:
+    static const int MAX_BATCH = SQL_INSERT_MAX_ROWS;
+
+    group_commit() : m_writing(false), m_batches(0), m_rows(0), m_failed(0), m_max_batch(0) {}
+
+    /**
+     * 注册一个用户，等到所在的批写入后返回
+     * @param pool 连接池，用于取得连接上缓存的预编译语句
+     * @param con 调用线程持有的连接，成为写入者时用它写入；为空（取连接超时）时直接返回失败
+     * @param close_log 供LOG_*宏使用
+     * @return 是否插入成功
+     */
+    bool insert(connection_pool* pool, MYSQL* con, const char* name, const char* passwd, int close_log) {
+        if (con == nullptr) {
+            int m_close_log = close_log;
+            LOG_ERROR("INSERT error: no database connection for %s", name);
+            return false;
+        }
+        row r;
+        r.name = name;
+        r.passwd = passwd;
+        r.ok = false;
+        r.done = false;
+        m_lock.lock();
+        m_queue.push_back(&r);
+        while (!r.done) {
+            if (m_writing) {
+                m_cond.wait(m_lock.get());
+                continue;
+            }
+            m_writing = true;
+            size_t n = m_queue.size() < (size_t)MAX_BATCH ? m_queue.size() : MAX_BATCH;
+            vector<row*> batch(m_queue.begin(), m_queue.begin() + n);
+            m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+            m_lock.unlock();
+
+            write(pool, con, batch, close_log);
+
+            m_lock.lock();
+            for (size_t i = 0; i < batch.size(); i++) {
+                batch[i]->done = true;
+                m_failed += !batch[i]->ok;
+            }
+            m_batches++;
+            m_rows += batch.size();
+            if ((int)batch.size() > m_max_batch) {
+                m_max_batch = batch.size();
+            }
+            m_writing = false;
+            // 唤醒本批的注册，队列中还有注册时其中一个成为下一个写入者
+            m_cond.broadcast();
+        }
+        m_lock.unlock();
+        return r.ok;
+    }
+
+    void get_stats(group_commit_stats& st) {
+        m_lock.lock();
+        st.batches = m_batches;
+        st.rows = m_rows;
+        st.failed = m_failed;
+        st.max_batch = m_max_batch;
+        m_lock.unlock();
+    }
+
+private:
+    // 一个等待写入的注册，在注册线程的栈上
+    struct row {
+        const char* name;
+        const char* passwd;
+        bool ok;
+        bool done;
+    };
+
+    static void bind_string(MYSQL_BIND* bind, const char* buf, unsigned long* len) {
+        memset(bind, 0, sizeof(*bind));
+        bind->buffer_type = MYSQL_TYPE_STRING;
+        bind->buffer = (char*)buf;
+        bind->buffer_length = *len;
+        bind->length = len;
+    }
+
+    // 用一条语句插入rows[0..n)
+    static bool execute(connection_pool* pool, MYSQL* con, row** rows, int n, unsigned int* err, int close_log) {
+        int m_close_log = close_log;
+        int id = sql_insert_stmt(n);
+        MYSQL_STMT* stmt = pool->GetStatement(con, id);
+        if (stmt == nullptr) {
+            *err = 0;
+            return false;
+        }
+        MYSQL_BIND params[2 * SQL_INSERT_MAX_ROWS];
+        unsigned long lens[2 * SQL_INSERT_MAX_ROWS];
+        for (int i = 0; i < n; i++) {
+            lens[2 * i] = strlen(rows[i]->name);
+            lens[2 * i + 1] = strlen(rows[i]->passwd);
+            bind_string(&params[2 * i], rows[i]->name, &lens[2 * i]);
+            bind_string(&params[2 * i + 1], rows[i]->passwd, &lens[2 * i + 1]);
+        }
+        if (mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt)) {
+            *err = mysql_stmt_errno(stmt);
+            LOG_ERROR("INSERT error: %s", mysql_stmt_error(stmt));
+            // 语句可能随连接失效，下次重新准备
+            pool->DropStatement(con, id);
+            return false;
+        }
+        return true;
+    }
+
+    // 写入一批注册，结果记在各个row中
+    static void write(connection_pool* pool, MYSQL* con, vector<row*>& batch, int close_log) {
+        unsigned int err;
+        if (execute(pool, con, &batch[0], batch.size(), &err, close_log)) {
+            for (size_t i = 0; i < batch.size(); i++) {
+                batch[i]->ok = true;
+            }
+        }
+        else if (batch.size() > 1 && ER_DUP_ENTRY == err) {
+            // 整条语句因为其中的同名用户失败（只在有唯一索引时出现），逐个插入，每个注册得到自己的结果
+            for (size_t i = 0; i < batch.size(); i++) {
+                batch[i]->ok = execute(pool, con, &batch[i], 1, &err, close_log);
+            }
+        }
+    }
+
+    locker m_lock;              // 保护以下成员
+    cond m_cond;                // 一批写入完成
+    deque<row*> m_queue;        // 等待写入的注册
+    bool m_writing;             // 是否有线程正在写入
+    long long m_batches;
+    long long m_rows;
+    long long m_failed;
+    int m_max_batch;
+};
+
+#endif
@@ -0,0 +1,13 @@
+-- 已有的user表加上username的唯一索引，在维护窗口手动执行，服务器不会自己修改表结构
+-- mysql -u root -p mywebdb < CGImysql/unique_username.sql
+--
+-- 没有这个索引时同名用户也能插入成功，服务器每次注册都先查询数据库确认用户名没有被占用。
+-- 加上之后（服务器在下一次建立用户名过滤器时检查到，最多10分钟），过滤器判断没有的用户名直接插入，
+-- 合并插入因为同名失败时逐个重试。
+-- 大表上加索引会重建表，InnoDB下可以在线执行，但仍需要ALTER权限和与表大小相当的时间、磁盘空间。
+
+-- 1. 先找出已经重复的用户名，有结果时需要先人工处理（改名或删除多余的行），否则第2步会失败
+SELECT username, COUNT(*) AS n FROM user GROUP BY username HAVING n > 1;
+
+-- 2. 加唯一索引
+ALTER TABLE user ADD UNIQUE KEY username (username), ALGORITHM=INPLACE, LOCK=NONE;
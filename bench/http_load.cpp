@@ -0,0 +1,127 @@
+// 注册和登录的压力测试：多个客户端线程同时向运行中的服务器提交注册或登录表单，统计每秒完成的请求数。
+// 需要先启动服务器并连接好MySQL，所以make bench不运行它。
+// 用法：http_load [-a 服务器地址] [-p 端口] [-c 客户端数] [-n 每个客户端的请求数] [-m r|l] [-u 用户名前缀]
+// -m r注册用户名为“前缀+客户端编号_序号”的新用户，-m l用同样的用户名和密码登录，应当先用相同的参数注册一遍。
+// 每个请求一个短连接；注册成功返回登录页，登录成功返回欢迎页，其余都算失败（例如用户名已被注册）。
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 提交一次表单，返回响应是否包含expect
+static bool post(const sockaddr_in& addr, const char* url, const char* body, const char* expect) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return false;
+    }
+    char req[512];
+    int len = snprintf(req, sizeof(req), "POST %s HTTP/1.1\r\nHost: bench\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                       url, strlen(body), body);
+    if (write(fd, req, len) != len) {
+        close(fd);
+        return false;
+    }
+    std::string resp;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        resp.append(buf, n);
+        if (resp.find("</html>") != std::string::npos) {
+            break;
+        }
+    }
+    close(fd);
+    return resp.find(expect) != std::string::npos;
+}
+
+int main(int argc, char* argv[]) {
+    const char* host = "127.0.0.1";
+    const char* prefix = "bench";
+    int port = 9006, clients = 8, per_client = 1000;
+    char mode = 'r';
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:c:n:m:u:")) != -1) {
+        switch (opt) {
+        case 'a':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'n':
+            per_client = atoi(optarg);
+            break;
+        case 'm':
+            mode = optarg[0];
+            break;
+        case 'u':
+            prefix = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-a host] [-p port] [-c clients] [-n requests per client] [-m r|l] [-u prefix]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (mode != 'r' && mode != 'l') {
+        fprintf(stderr, "-m must be r (register) or l (login)\n");
+        return 1;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", host);
+        return 1;
+    }
+    // 注册成功跳转到登录页，登录成功跳转到欢迎页
+    const char* url = 'r' == mode ? "/3CGISQL.cgi" : "/2CGISQL.cgi";
+    const char* expect = 'r' == mode ? "<title>Sign in</title>" : "<title>WebServer</title>";
+
+    std::atomic<long> ok(0), failed(0);
+    std::vector<std::thread> workers;
+    double t0 = now_s();
+    for (int c = 0; c < clients; c++) {
+        workers.emplace_back([&, c] {
+            char body[256];
+            for (int i = 0; i < per_client; i++) {
+                snprintf(body, sizeof(body), "user=%s%d_%d&password=pw%d", prefix, c, i, i);
+                if (post(addr, url, body, expect)) {
+                    ok++;
+                } else {
+                    failed++;
+                }
+            }
+        });
+    }
+    for (size_t c = 0; c < workers.size(); c++) {
+        workers[c].join();
+    }
+    double secs = now_s() - t0;
+    long total = (long)clients * per_client;
+    printf("%s clients %d: %ld requests in %.2fs, %.0f/s, ok %ld, failed %ld\n", 'r' == mode ? "register" : "login",
+           clients, total, secs, total / secs, ok.load(), failed.load());
+    return 0;
+}
@@ -0,0 +1,87 @@
+// 日志吞吐量基准测试：多个线程同时用LOG_INFO写日志，统计调用线程每秒写入的行数。
+// 用法：log_bench [-l 写日志方式] [-t 线程数] [-n 每个线程的行数] [-q 环形缓冲区条数] [-F 缓冲区满时的策略] [-d 日志目录]
+// 写日志方式与服务器的-l相同（0同步、1异步、2每线程缓冲、3延迟格式化、4二进制、5内存映射环形文件），
+// 参数与服务器启动时相同。不指定-d时在/tmp下新建目录，日志文件留给调用者检查和删除。
+// 异步的几种方式统计的是调用线程的速度，退出时等后台线程写完，这部分时间不计入。
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../log/log.h"
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char* argv[]) {
+    int mode = 0, threads = 4, queue = 800, full_policy = log_ring::FULL_BLOCK;
+    long lines = 500000;
+    string dir;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:t:n:q:F:d:")) != -1) {
+        switch (opt) {
+        case 'l':
+            mode = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'n':
+            lines = atol(optarg);
+            break;
+        case 'q':
+            queue = atoi(optarg);
+            break;
+        case 'F':
+            full_policy = atoi(optarg);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-l mode] [-t threads] [-n lines per thread] [-q queue] [-F full policy] [-d dir]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (dir.empty()) {
+        char tmp[] = "/tmp/log_bench.XXXXXX";
+        if (mkdtemp(tmp) == nullptr) {
+            perror("mkdtemp");
+            return 1;
+        }
+        dir = tmp;
+        fprintf(stderr, "log files in %s\n", tmp);
+    }
+    string name = dir + (4 == mode ? "/ServerLog.bin" : 5 == mode ? "/ServerLog.ring" : "/ServerLog");
+    int uses_ring = (1 == mode || 3 == mode || 4 == mode);
+    if (!Log::get_instance()->init(name.c_str(), 0, 2000, 800000, uses_ring ? queue : 0, -1, mode, full_policy)) {
+        fprintf(stderr, "log init failed\n");
+        return 1;
+    }
+
+    int m_close_log = 0;  // 供LOG_*宏使用
+    long long t0 = now_ns();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&m_close_log, t, lines] {
+            for (long i = 0; i < lines; i++) {
+                LOG_INFO("thread %d line %ld value %s", t, i, "abcdefgh");
+            }
+        });
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    double secs = (now_ns() - t0) / 1e9;
+    printf("mode %d threads %d: %.0f lines/s (dropped %lld)\n", mode, threads, threads * lines / secs,
+           Log::get_instance()->dropped());
+    // 日志单例在exit时析构，等后台线程写完剩余的日志
+    return 0;
+}
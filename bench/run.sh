@@ -0,0 +1,38 @@
+#!/bin/bash
+# 运行提交说明中引用的基准测试，make bench调用。结果与CPU核数有关，核数少于线程数时主要反映调度开销。
+cd "$(dirname "$0")"
+
+echo "== 线程池：共享队列(-w 0)与工作窃取(-w 1)，8/16/32个工作线程，饱和吞吐量和固定速率下的排队延迟"
+for t in 8 16 32; do
+    for w in 0 1; do
+        ./threadpool_bench -w $w -t $t -n 1000000
+        ./threadpool_bench -w $w -t $t -n 200000 -r 100000
+    done
+done
+
+echo "== 线程池：批量提交(-k)和批量取出(-b)，每个请求分摊的入队、出队和唤醒次数"
+for bk in "1 1" "8 1" "1 64" "8 64"; do
+    set -- $bk
+    ./threadpool_bench -t 8 -n 1000000 -b $1 -k $2
+done
+
+echo "== 日志：各写日志方式(-l 0..5)在1/2/4/8个线程下调用线程每秒写入的行数"
+dir=$(mktemp -d)
+for l in 0 1 2 3 4 5; do
+    for t in 1 2 4 8; do
+        ./log_bench -l $l -t $t -n 200000 -d "$dir"
+        rm -f "$dir"/*
+    done
+done
+rm -rf "$dir"
+
+echo "== 用户缓存：user_cache与std::map加互斥锁，载入时间、每个用户的内存和并发登录校验"
+./user_cache_bench -n 2000000
+
+echo "== 用户缓存：容量10万时放入500万个不同用户的内存，以及冷用户扫描下热用户的命中率"
+./user_cache_bench -n 5000000 -U 100000
+
+echo "== 用户名过滤器：大小、查询耗时和误判率，以及重建与注册同时进行时是否丢失用户名"
+for n in 100000 1000000 4000000; do
+    ./user_filter_bench -n $n
+done
@@ -0,0 +1,149 @@
+// 线程池吞吐量和排队延迟基准测试：一个线程模拟事件循环不断提交请求，工作线程处理，
+// 比较共享队列（-w 0）和工作窃取（-w 1）两种调度模式在不同线程数下的表现。
+// 用法：threadpool_bench [-w 调度模式] [-t 线程数] [-n 请求数] [-c 每个请求的工作量] [-r 每秒提交的请求数]
+//                        [-b 工作线程每次最多取出的请求数] [-k 每次批量提交的请求数]
+// -k大于1时用append_batch一次提交k个请求，模拟事件循环把一轮epoll_wait的事件一起交给线程池。
+// 不指定-r时尽快提交，测的是饱和吞吐量，此时排队延迟主要由队列长度决定；指定-r时按固定速率提交，测排队延迟。
+// 不访问数据库（连接池为空），请求在proactor模式下直接调用process()。
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+
+#include "../threadpool/threadpool.h"
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 排队延迟（提交到开始处理）按2的幂分桶统计，第i桶为[2^i, 2^(i+1))纳秒
+static const int BUCKETS = 48;
+static std::atomic<long long> g_latency[BUCKETS];
+static std::atomic<long long> g_done(0);
+static int g_work = 200;
+
+// 满足threadpool<T>对请求类型要求的最小请求
+struct bench_request {
+    int m_state;
+    volatile int improv;
+    volatile int timer_flag;
+    MYSQL* mysql;
+    long long enqueue_ns;
+
+    bench_request() : m_state(0), improv(0), timer_flag(0), mysql(nullptr), enqueue_ns(0) {}
+    bool read_once() { return true; }
+    bool write() { return true; }
+    bool is_db_request() { return false; }
+    void reply_busy() {}
+    void process() {
+        long long wait = now_ns() - enqueue_ns;
+        int b = 0;
+        while (b < BUCKETS - 1 && (2LL << b) <= wait) {
+            b++;
+        }
+        g_latency[b].fetch_add(1, std::memory_order_relaxed);
+        for (volatile int i = 0; i < g_work; i++) {
+        }
+        g_done.fetch_add(1, std::memory_order_release);
+    }
+};
+
+// 第p百分位所在桶的上界（纳秒）
+static long long percentile(long long total, double p) {
+    long long want = (long long)(total * p), seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += g_latency[b].load();
+        if (seen > want) {
+            return 2LL << b;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int mode = 0, threads = 8;
+    long n = 1000000;
+    long rate = 0;
+    int batch = 1, submit = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:t:n:c:r:b:k:")) != -1) {
+        switch (opt) {
+        case 'w':
+            mode = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'n':
+            n = atol(optarg);
+            break;
+        case 'c':
+            g_work = atoi(optarg);
+            break;
+        case 'r':
+            rate = atol(optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 'k':
+            submit = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-w mode] [-t threads] [-n requests] [-c work] [-r rate] [-b batch] [-k submit]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    // 请求对象循环复用，个数大于队列容量，复用时前一轮的同一个请求一定已经处理完
+    const int QUEUE = 10000;
+    const int POOL = 4 * QUEUE;
+    std::vector<bench_request> reqs(POOL);
+    if (submit < 1 || submit > QUEUE) {
+        submit = 1;
+    }
+    threadpool<bench_request>* pool = new threadpool<bench_request>(0, nullptr, threads, QUEUE, mode, batch);
+
+    std::vector<bench_request*> group(submit);
+    long long t0 = now_ns();
+    for (long i = 0; i < n; ) {
+        int k = n - i < submit ? n - i : submit;
+        while (rate > 0 && now_ns() < t0 + i * 1000000000LL / rate) {
+        }
+        while (i + k > POOL && g_done.load(std::memory_order_acquire) <= i + k - 1 - POOL) {
+            sched_yield();
+        }
+        long long ts = now_ns();
+        for (int j = 0; j < k; j++) {
+            group[j] = &reqs[(i + j) % POOL];
+            group[j]->enqueue_ns = ts;
+        }
+        // 队列满时只接受一部分，剩下的下一轮重新提交
+        int accepted = 1 == k ? (pool->append_p(group[0]) ? 1 : 0) : pool->append_batch(&group[0], nullptr, k);
+        if (accepted < k) {
+            sched_yield();
+        }
+        i += accepted;
+    }
+    while (g_done.load(std::memory_order_acquire) < n) {
+        usleep(100);
+    }
+    double secs = (now_ns() - t0) / 1e9;
+    threadpool_stats st;
+    pool->get_stats(st);
+    delete pool;
+
+    printf("mode %d threads %d rate %ld batch %d submit %d: %.0f req/s, queue wait p50 <%.1fus p99 <%.1fus p99.9 <%.1fus\n",
+           mode, threads, rate, batch, submit, n / secs, percentile(n, 0.5) / 1000.0, percentile(n, 0.99) / 1000.0,
+           percentile(n, 0.999) / 1000.0);
+    // 每个请求分摊的入队操作、出队操作、工作线程睡眠和唤醒（futex）次数
+    printf("    per request: enqueue ops %.3f, dequeue ops %.3f, sleeps %.3f, wakeups %.3f\n",
+           (double)st.enqueue_calls / n, (double)st.dequeue_calls / n, (double)st.sleeps / n, (double)st.wake_calls / n);
+    return 0;
+}
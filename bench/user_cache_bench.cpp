@@ -0,0 +1,169 @@
+// 用户缓存基准测试：比较user_cache与原先的std::map加一把互斥锁，
+// 统计载入N个用户的时间、每个用户占用的堆内存，以及1/4/8个线程同时登录校验时每秒的查询次数。
+// 用法：user_cache_bench [-n 用户数] [-q 每个线程的查询次数] [-U 容量]
+// 不指定-U时不限制容量、不过期，只测查找结构本身。
+// 指定-U时测容量有限的缓存：依次放入n个不同的用户，看缓存的用户数和内存是否停在容量附近；
+// 再在冷用户的扫描中穿插访问一组热用户，看热用户的命中率。
+#include <unistd.h>
+#include <time.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../http/user_cache.h"
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t heap_used() {
+    struct mallinfo2 m = mallinfo2();
+    return m.uordblks + m.hblkhd;
+}
+
+// 容量有限时的内存和热用户命中率
+static void bench_bounded(int n, size_t capacity) {
+    char name[32];
+    user_cache scan;
+    scan.init(capacity);
+    double t0 = now_s();
+    for (int i = 1; i <= n; i++) {
+        snprintf(name, sizeof(name), "user%d", i);
+        scan.put(name, "password12", 10);
+        if (0 == i % (n / 5 > 0 ? n / 5 : 1) || i == n) {
+            user_cache_stats st;
+            scan.get_stats(st);
+            printf("capacity %zu, %d distinct users: cached %zu, memory %zu KB, evictions %lld\n", capacity, i, st.users,
+                   st.memory / 1024, st.evictions);
+        }
+    }
+    printf("capacity %zu: %.2fM puts/s with eviction\n", capacity, n / (now_s() - t0) / 1e6);
+
+    // 热用户数为容量的十分之一，每访问一次热用户就有一个冷用户（不存在的用户名）放入缓存
+    user_cache hot;
+    hot.init(capacity);
+    int hot_users = capacity / 10 > 0 ? capacity / 10 : 1;
+    for (int i = 0; i < hot_users; i++) {
+        snprintf(name, sizeof(name), "hot%d", i);
+        hot.put(name, "pw", 2);
+    }
+    std::mt19937 rng(7);
+    long hits = 0, checks = 0;
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "hot%u", (unsigned)(rng() % hot_users));
+        checks++;
+        if (USER_MATCH == hot.check(name, "pw")) {
+            hits++;
+        } else {
+            hot.put(name, "pw", 2);
+        }
+        snprintf(name, sizeof(name), "cold%d", i);
+        hot.put_absent(name);
+    }
+    printf("capacity %zu, %d hot users under a cold scan: hit rate %.2f%%\n", capacity, hot_users, 100.0 * hits / checks);
+}
+
+int main(int argc, char* argv[]) {
+    int n = 2000000;
+    long queries = 2000000;
+    size_t capacity = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:q:U:")) != -1) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'q':
+            queries = atol(optarg);
+            break;
+        case 'U':
+            capacity = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n users] [-q queries per thread] [-U capacity]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n < 1) {
+        n = 1;
+    }
+    if (capacity > 0) {
+        bench_bounded(n, capacity);
+        return 0;
+    }
+
+    std::vector<std::string> names(n);
+    for (int i = 0; i < n; i++) {
+        names[i] = "user" + std::to_string(i * 7919u);
+    }
+    const char* password = "password12";
+
+    // 0为std::map加互斥锁，1为user_cache
+    for (int impl = 0; impl < 2; impl++) {
+        const char* label = impl ? "user_cache" : "std::map + locker";
+        // user_cache按缓存行对齐，放在栈上，不用C++17之前不保证对齐的new
+        user_cache cache_storage;
+        user_cache* cache = nullptr;
+        std::map<std::string, std::string>* users = nullptr;
+        locker lock;
+
+        size_t h0 = heap_used();
+        double t0 = now_s();
+        if (impl) {
+            cache = &cache_storage;
+            for (int i = 0; i < n; i++) {
+                cache->put(names[i].c_str(), password, strlen(password));
+            }
+        } else {
+            users = new std::map<std::string, std::string>;
+            for (int i = 0; i < n; i++) {
+                lock.lock();
+                (*users)[names[i]] = password;
+                lock.unlock();
+            }
+        }
+        double load = now_s() - t0;
+        size_t mem = heap_used() - h0;
+
+        for (int threads : {1, 4, 8}) {
+            std::atomic<long> hits(0);
+            std::vector<std::thread> workers;
+            double s = now_s();
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&, t] {
+                    std::mt19937 rng(t);
+                    long h = 0;
+                    for (long k = 0; k < queries; k++) {
+                        const std::string& name = names[rng() % n];
+                        if (cache) {
+                            h += USER_MATCH == cache->check(name.c_str(), password);
+                        } else {
+                            lock.lock();
+                            std::map<std::string, std::string>::iterator it = users->find(name);
+                            h += it != users->end() && it->second == password;
+                            lock.unlock();
+                        }
+                    }
+                    hits += h;
+                });
+            }
+            for (size_t t = 0; t < workers.size(); t++) {
+                workers[t].join();
+            }
+            double secs = now_s() - s;
+            printf("%-18s users %d threads %d: %.2fM lookups/s (hits %ld)\n", label, n, threads,
+                   threads * queries / secs / 1e6, hits.load());
+        }
+        printf("%-18s load %.2fs, heap %.1f MB (%.1f bytes per user)\n", label, load, mem / 1048576.0, (double)mem / n);
+        delete users;
+    }
+    return 0;
+}
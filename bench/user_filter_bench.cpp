@@ -0,0 +1,118 @@
+// 用户名过滤器基准测试：用n个用户建立过滤器，统计位数组大小、每次查询的耗时和误判率，
+// 再注册n个新用户（达到设计容量）后统计误判率。最后让重建与注册同时进行，检查注册的用户名都能查到。
+// 用法：user_filter_bench [-n 用户数] [-p 查询次数] [-r 重建次数]
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+#include "../http/user_filter.h"
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 用不在过滤器中的用户名查询probes次，返回判断可能有的比例
+static double false_positive_rate(user_filter& f, long probes, double* ns_per_probe) {
+    char name[32];
+    long fp = 0;
+    double t0 = now_s();
+    for (long i = 0; i < probes; i++) {
+        snprintf(name, sizeof(name), "other%ld", i);
+        fp += f.may_contain(name);
+    }
+    if (ns_per_probe) {
+        *ns_per_probe = (now_s() - t0) * 1e9 / probes;
+    }
+    return (double)fp / probes;
+}
+
+int main(int argc, char* argv[]) {
+    long n = 1000000, probes = 1000000;
+    int rebuilds = 60;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:r:")) != -1) {
+        switch (opt) {
+        case 'n':
+            n = atol(optarg);
+            break;
+        case 'p':
+            probes = atol(optarg);
+            break;
+        case 'r':
+            rebuilds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n users] [-p probes] [-r rebuilds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (probes < 1) {
+        probes = 1;
+    }
+
+    char name[32];
+    {
+        user_filter f;
+        double t0 = now_s();
+        f.begin_build(n);
+        for (long i = 0; i < n; i++) {
+            int len = snprintf(name, sizeof(name), "user%ld", i);
+            f.build_add(name, len);
+        }
+        f.finish_build(true, n, 0);
+        double build = now_s() - t0;
+        double ns;
+        double fpr = false_positive_rate(f, probes, &ns);
+        for (long i = n; i < 2 * n; i++) {
+            snprintf(name, sizeof(name), "user%ld", i);
+            f.add(name);
+        }
+        double fpr_full = false_positive_rate(f, probes, nullptr);
+        user_filter_stats st;
+        f.get_stats(st);
+        printf("users %ld: %zu KB, build %.2fs, %.0f ns per probe (with snprintf), false positives %.3f%%, "
+               "at 2x users %.3f%%\n", n, st.memory / 1024, build, ns, 100 * fpr, 100 * fpr_full);
+    }
+
+    // 一个线程不断注册，主线程按已注册的用户数反复重建，结束后每个注册过的用户名都应当查得到
+    user_filter f;
+    std::atomic<long> registered(0);
+    std::atomic<bool> stop(false);
+    std::thread writer([&] {
+        char buf[32];
+        for (long i = 0; !stop.load() && i < 300000; i++) {
+            snprintf(buf, sizeof(buf), "r%ld", i);
+            // 与服务器一样，先写入数据库（这里是计数），再加入过滤器
+            registered.store(i + 1);
+            f.add(buf);
+            if (0 == i % 500) {
+                usleep(200);
+            }
+        }
+    });
+    for (int r = 0; r < rebuilds; r++) {
+        usleep(2000);
+        // 与服务器一样先发布新的位数组，再读取已注册的用户
+        f.begin_build(registered.load());
+        long upto = registered.load();
+        for (long i = 0; i < upto; i++) {
+            int len = snprintf(name, sizeof(name), "r%ld", i);
+            f.build_add(name, len);
+        }
+        f.finish_build(true, upto, 0);
+    }
+    stop.store(true);
+    writer.join();
+    long missing = 0;
+    for (long i = 0; i < registered.load(); i++) {
+        snprintf(name, sizeof(name), "r%ld", i);
+        missing += !f.may_contain(name);
+    }
+    printf("%d rebuilds during registration: %ld registered, %ld missing\n", rebuilds, registered.load(), missing);
+    return missing ? 1 : 0;
+}
@@ -4,7 +4,7 @@ Config::Config(){
     //端口号,默认9006
     PORT = 9006;
 
-    //日志写入方式，默认同步
+    //日志写入方式，默认同步,1为环形缓冲区异步,2为每线程缓冲,3为延迟格式化,4为二进制(用log_decode查看),5为内存映射环形文件(用log_dump查看)
     LOGWrite = 0;
 
     //触发组合模式,默认listenfd LT + connfd LT
@@ -22,6 +22,12 @@ Config::Config(){
     //数据库连接池数量,默认8
     sql_num = 8;
 
+    //数据库连接池数量上限,默认0,即连接数固定为sql_num;大于sql_num时,取连接需要等待则新建连接,空闲过久的多余连接被关闭
+    max_sql_num = 0;
+
+    //用户缓存的容量(用户数),默认100000,登录时按需查询数据库后缓存,满了按CLOCK淘汰,0为不限制
+    user_cache = 100000;
+
     //线程池内的线程数量,默认8
     thread_num = 8;
 
@@ -30,11 +36,44 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //线程池调度模式,默认所有线程共享一个任务队列,1为工作窃取
+    sched_mode = 0;
+
+    //工作线程每次最多连续取出的任务数,默认8,只在队列积压时生效
+    batch_size = 8;
+
+    //线程池内的线程数量上限,默认0,即线程数固定为thread_num
+    max_thread_num = 0;
+
+    //过载保护的目标排队时间,默认5ms,请求排队时间持续100ms超过该值时开始直接回复503,0为关闭
+    codel_target = 5;
+
+    //绑核使用的CPU列表,如"0-7",第一个CPU给事件循环,其余依次分给工作线程,最后一个同时给异步日志线程,默认为空不绑核
+    cpu_list = "";
+
+    //异步日志环形缓冲区满时的处理方式,默认0阻塞等待,1为丢弃并计数
+    log_full = 0;
+
+    //运行时日志级别,默认0即DEBUG,1为INFO,2为WARN,3为ERROR,运行中可用SIGUSR1降低一级、SIGUSR2提高一级
+    log_level = 0;
+
+    //单个日志文件的最大大小(MB),超过后分割出新文件,默认256,0为只按天和行数分割
+    log_max_mb = 256;
+
+    //-l 5时内存映射环形文件的大小(MB),默认0即64MB
+    log_ring_mb = 0;
+
+    //最多保留的已分割日志文件数(包括压缩后的),超出时删除最旧的,默认0不限制
+    log_keep = 0;
+
+    //是否在后台用gzip压缩分割出的旧日志文件,默认1压缩,0不压缩
+    log_compress = 1;
 }
 
 void Config::parse_arg(int argc, char* argv[]) {
     int opt;
-    const char* str = "p:l:m:o:s:t:c:a:";
+    const char* str = "p:l:m:o:s:S:U:t:c:a:w:b:T:q:A:F:L:R:M:K:Z:";
     //通过循环调用getopt函数，解析命令行参数argc和argv，直到没有参数可解析（opt等于-1）。str参数指定了可识别的选项字符。该循环确保每个命令行选项都被适当地解析和处理。
     while ((opt = getopt(argc, argv, str)) != -1) {
         switch (opt) {
@@ -64,6 +103,16 @@ void Config::parse_arg(int argc, char* argv[]) {
             sql_num = atoi(optarg);
             break;
         }
+        case 'S':
+        {
+            max_sql_num = atoi(optarg);
+            break;
+        }
+        case 'U':
+        {
+            user_cache = atoi(optarg);
+            break;
+        }
         case 't':
         {
             thread_num = atoi(optarg);
@@ -79,6 +128,61 @@ void Config::parse_arg(int argc, char* argv[]) {
             actor_model = atoi(optarg);
             break;
         }
+        case 'w':
+        {
+            sched_mode = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            batch_size = atoi(optarg);
+            break;
+        }
+        case 'T':
+        {
+            max_thread_num = atoi(optarg);
+            break;
+        }
+        case 'q':
+        {
+            codel_target = atoi(optarg);
+            break;
+        }
+        case 'A':
+        {
+            cpu_list = optarg;
+            break;
+        }
+        case 'F':
+        {
+            log_full = atoi(optarg);
+            break;
+        }
+        case 'L':
+        {
+            log_level = atoi(optarg);
+            break;
+        }
+        case 'R':
+        {
+            log_max_mb = atoi(optarg);
+            break;
+        }
+        case 'M':
+        {
+            log_ring_mb = atoi(optarg);
+            break;
+        }
+        case 'K':
+        {
+            log_keep = atoi(optarg);
+            break;
+        }
+        case 'Z':
+        {
+            log_compress = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
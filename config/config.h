@@ -34,6 +34,12 @@ public:
     //数据库连接池数量
     int sql_num;
 
+    //数据库连接池数量上限
+    int max_sql_num;
+
+    //用户缓存的容量
+    int user_cache;
+
     //线程池内的线程数量
     int thread_num;
 
@@ -42,6 +48,39 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //线程池调度模式
+    int sched_mode;
+
+    //工作线程每次最多连续取出的任务数
+    int batch_size;
+
+    //线程池内的线程数量上限
+    int max_thread_num;
+
+    //过载保护的目标排队时间(毫秒)
+    int codel_target;
+
+    //绑核使用的CPU列表
+    string cpu_list;
+
+    //异步日志缓冲区满时的处理方式
+    int log_full;
+
+    //运行时日志级别
+    int log_level;
+
+    //单个日志文件的最大大小(MB)
+    int log_max_mb;
+
+    //内存映射环形日志文件的大小(MB)
+    int log_ring_mb;
+
+    //最多保留的已分割日志文件数
+    int log_keep;
+
+    //是否压缩分割出的旧日志文件
+    int log_compress;
 };
 
 #endif
\ No newline at end of file
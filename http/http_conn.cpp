@@ -22,42 +22,288 @@ const char *error_404_form = "The requested file was not found on this server.\n
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
-locker m_lock;
-map<string, string> users;
+// 服务器错误 - 过载 (503)，整个响应预先生成，过载时不再做任何格式化
+#define BUSY_503_FORM "The server is overloaded, please retry later.\n"
+const char http_conn::BUSY_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Length: " "46" "\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    BUSY_503_FORM;
+const int http_conn::BUSY_RESPONSE_LEN = sizeof(http_conn::BUSY_RESPONSE) - 1;
+static_assert(sizeof(BUSY_503_FORM) - 1 == 46, "Content-Length of the 503 response is out of date");
+
+// 用户名到密码的缓存，登录时按需从数据库查询后放入，容量有限，内部按分片加锁
+user_cache users;
+// 数据库中用户名的过滤器，注册时确定用户名没有被占用就不再查询数据库
+user_filter user_names;
+// 合并同时到达的注册，一次往返写入多个用户
+group_commit user_inserts;
+// user表的username列是否已确认有唯一索引（由CGImysql/unique_username.sql加上，服务器只检查不修改表结构）。
+// 有了它插入同名用户会失败，否则会插入成功，留下两个同名用户
+std::atomic<bool> unique_names(false);
+
+#ifdef ASYNC_DB
+sql_async<http_conn>* http_conn::m_async_db = nullptr;
+#endif
+
+// 注册的结果：插入成功时把users中占下的用户名换成带密码的记录，否则去掉，返回要跳转的页面
+static const char* register_result(const char* name, const char* password, bool reserved, bool inserted) {
+    if (reserved && inserted) {
+        users.put(name, password, strlen(password));
+        user_names.add(name);
+        return "/log.html";
+    }
+    // 已存在同名用户或插入失败，重定向到注册错误页面
+    if (reserved) {
+        users.erase(name);
+    }
+    return "/registerError.html";
+}
 
-/**
- * 初始化MySQL查询结果
- * 
- * 该函数用于从数据库中查询用户信息，并将结果存储在一个map中
- * 使用了RAII技术管理数据库连接，确保异常情况下能正确释放资源
- * 
- * 参数:
- * connPool: 数据库连接池的指针，用于获取数据库连接
- */
-void http_conn::initmysql_result(connection_pool* connPool) {
-    // 声明MySQL连接指针，初始化为nullptr
-    MYSQL *mysql = nullptr;
-    // 使用RAII技术管理MySQL连接，确保异常安全
-    connectionRAII mysqlcon(&mysql, connPool);
+// 注册时是否要先查询数据库确认用户名没有被占用。users只是缓存，不在其中不说明数据库中没有。
+// 不查询直接插入（过滤器判断没有时跳过查询，合并插入靠数据库拒绝同名用户）只在unique_names为真时成立：
+// 没有唯一索引时同名用户也能插入成功，必须先查询。同步和ASYNC_DB的注册都经过这里决定是否查询，
+// 唯一索引缺失或检查失败时unique_names保持为假，所有注册都先查询
+static bool need_confirm(const char* name) {
+    return !unique_names.load(std::memory_order_acquire) || user_names.may_contain(name);
+}
+
+// 查询确认用户名没有被占用时调用：有唯一索引时查询是因为过滤器判断可能有，计为误判
+static void confirmed_absent() {
+    if (unique_names.load(std::memory_order_relaxed)) {
+        user_names.false_positive();
+    }
+}
+
+// 缓存查询数据库的结果：查到的用户和数据库中没有的用户都放入users
+static void cache_user(const char* name, const char* password, unsigned long len) {
+    if (password) {
+        users.put(name, password, len);
+    }
+    else {
+        users.put_absent(name);
+    }
+}
+
+// 绑定一个字符串参数或结果列，len是参数的长度，或者取回结果时列的实际长度
+static void bind_string(MYSQL_BIND* bind, char* buf, unsigned long size, unsigned long* len) {
+    memset(bind, 0, sizeof(*bind));
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = buf;
+    bind->buffer_length = size;
+    bind->length = len;
+}
+
+// 注册新用户，与同时到达的注册合并成多行INSERT写入，返回是否插入成功
+bool http_conn::insert_user(const char* name, const char* password) {
+    return user_inserts.insert(connection_pool::GetInstance(), mysql, name, password, m_close_log);
+}
+
+// 用预编译语句查询用户的密码，用户存在时返回true
+// 查询不改变数据，执行中连接断开时重连后再查一次；注册不重试，避免重复插入
+// 返回1表示查到，0表示数据库中没有该用户，-1表示查询出错
+int http_conn::select_password(const char* name, string& password) {
+    connection_pool* connPool = connection_pool::GetInstance();
+    MYSQL_BIND param, result;
+    unsigned long name_len = strlen(name);
+    char buf[100];
+    unsigned long len = 0;
+    MYSQL_STMT* stmt = nullptr;
+    for (int attempt = 0; ; attempt++) {
+        stmt = connPool->GetStatement(mysql, SQL_SELECT_PASSWD);
+        if (stmt == nullptr) {
+            return -1;
+        }
+        bind_string(&param, (char*)name, name_len, &name_len);
+        bind_string(&result, buf, sizeof(buf), &len);
+        if (!mysql_stmt_bind_param(stmt, &param) && !mysql_stmt_execute(stmt) &&
+            !mysql_stmt_bind_result(stmt, &result) && !mysql_stmt_store_result(stmt)) {
+            break;
+        }
+        LOG_ERROR("SELECT error: %s", mysql_stmt_error(stmt));
+        connPool->DropStatement(mysql, SQL_SELECT_PASSWD);
+        if (attempt > 0 || !connection_pool::IsLost(mysql) || !connPool->CheckConnection(mysql)) {
+            return -1;
+        }
+    }
+    int ret = mysql_stmt_fetch(stmt);
+    bool found = (0 == ret || MYSQL_DATA_TRUNCATED == ret);
+    if (found) {
+        password.assign(buf, len < sizeof(buf) ? len : sizeof(buf));
+    }
+    mysql_stmt_free_result(stmt);
+    return found ? 1 : 0;
+}
+
+// 设置用户缓存的容量，在开始处理请求前调用
+void http_conn::init_cache(size_t capacity) {
+    users.init(capacity);
+}
+
+void http_conn::get_cache_stats(user_cache_stats& st) {
+    users.get_stats(st);
+}
+
+// 用户名过滤器重建的间隔，其他地方加入的用户最多过这么久才会计入
+static const int FILTER_REBUILD_S = 600;
+// 数据库不可用、建立失败时重试的间隔
+static const int FILTER_RETRY_S = 5;
+
+struct filter_arg {
+    string url;
+    string user;
+    string passwd;
+    string db;
+    int port;
+    int close_log;
+};
+
+// 检查user表是否有只含username一列的唯一索引。服务器不修改表结构，索引由CGImysql/unique_username.sql加上；
+// 没有时注册总是先查询数据库确认用户名，只在第一次发现时警告，之后每次建立过滤器时再检查
+static bool has_unique_names(MYSQL* mysql, int m_close_log) {
+    MYSQL_RES* result = nullptr;
+    if (mysql_query(mysql, "SHOW INDEX FROM user") || (result = mysql_store_result(mysql)) == nullptr) {
+        LOG_ERROR("user table: SHOW INDEX error: %s", mysql_error(mysql));
+        return false;
+    }
+    // 每行是索引的一列：Non_unique, Key_name, Column_name, Sub_part分别在第1、2、4、7列（从0数起）
+    map<string, int> columns;
+    map<string, bool> on_name;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result)) != nullptr) {
+        if (!row[1] || !row[2] || strcmp(row[1], "0") != 0) {
+            continue;
+        }
+        columns[row[2]]++;
+        if (row[4] && strcmp(row[4], "username") == 0 && !row[7]) {
+            on_name[row[2]] = true;
+        }
+    }
+    mysql_free_result(result);
+    for (map<string, bool>::iterator it = on_name.begin(); it != on_name.end(); ++it) {
+        if (1 == columns[it->first]) {
+            LOG_INFO("%s", "user table: unique key on username found");
+            return true;
+        }
+    }
+    static bool warned = false;
+    if (!warned) {
+        warned = true;
+        LOG_WARN("%s", "user table: no unique key on username, registration checks the database first; "
+                       "apply CGImysql/unique_username.sql");
+    }
+    return false;
+}
+
+// 从数据库建立一次用户名过滤器，返回是否成功。用单独的连接，先取用户数确定大小，
+// 再逐行读取用户名（mysql_use_result，不在客户端缓存整张表）
+static bool build_filter(const filter_arg* a) {
+    int m_close_log = a->close_log;  // 供LOG_*宏使用
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    MYSQL* mysql = mysql_init(nullptr);
+    if (mysql == nullptr) {
+        return false;
+    }
+    unsigned int timeout = connection_pool::CONNECT_TIMEOUT_S;
+    mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if (mysql_real_connect(mysql, a->url.c_str(), a->user.c_str(), a->passwd.c_str(), a->db.c_str(),
+                           a->port, nullptr, 0) == nullptr) {
+        LOG_ERROR("user filter: connect error: %s", mysql_error(mysql));
+        mysql_close(mysql);
+        return false;
+    }
+    if (!unique_names.load(std::memory_order_relaxed) && has_unique_names(mysql, m_close_log)) {
+        unique_names.store(true, std::memory_order_release);
+    }
+    long long count = 0;
+    MYSQL_RES* result = nullptr;
+    if (mysql_query(mysql, "SELECT COUNT(*) FROM user") || (result = mysql_store_result(mysql)) == nullptr) {
+        LOG_ERROR("user filter: SELECT error: %s", mysql_error(mysql));
+        mysql_close(mysql);
+        return false;
+    }
+    MYSQL_ROW row = mysql_fetch_row(result);
+    if (row && row[0]) {
+        count = atoll(row[0]);
+    }
+    mysql_free_result(result);
 
-    // 执行SQL查询语句，选择user表中的username和passwd字段
-    // 如果查询失败，记录错误日志
-    if (mysql_query(mysql, "SELECT username, passwd from user")) {
-        LOG_ERROR("SELECT error: %s\n", mysql_error(mysql));
+    user_names.begin_build(count);
+    if (mysql_query(mysql, "SELECT username FROM user") || (result = mysql_use_result(mysql)) == nullptr) {
+        LOG_ERROR("user filter: SELECT error: %s", mysql_error(mysql));
+        user_names.finish_build(false, 0, 0);
+        mysql_close(mysql);
+        return false;
+    }
+    long long n = 0;
+    while ((row = mysql_fetch_row(result)) != nullptr) {
+        unsigned long* lens = mysql_fetch_lengths(result);
+        if (row[0]) {
+            user_names.build_add(row[0], lens ? lens[0] : strlen(row[0]));
+            n++;
+        }
+    }
+    // 读到一半连接断开时mysql_fetch_row同样返回空，只能靠错误码区分
+    bool ok = 0 == mysql_errno(mysql);
+    if (!ok) {
+        LOG_ERROR("user filter: SELECT error: %s", mysql_error(mysql));
     }
+    mysql_free_result(result);
+    mysql_close(mysql);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long long ms = (t1.tv_sec - t0.tv_sec) * 1000LL + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+    user_names.finish_build(ok, n, ms);
+    if (ok) {
+        LOG_INFO("user filter: %lld users in %lld ms", n, ms);
+    }
+    return ok;
+}
 
-    // 获取查询结果集
-    MYSQL_RES* result = mysql_store_result(mysql);
-    // 获取结果集的列数
-    int num_fields = mysql_num_fields(result);
-    // 获取结果集的所有字段结构数组
-    MYSQL_FIELD *field = mysql_fetch_fields(result);
-    // 遍历结果集，将每行的用户名和密码添加到users map中
-    while (MYSQL_ROW row = mysql_fetch_row(result)) {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
+// 建立过滤器的后台线程，失败时稍后重试，成功后定期重建
+static void* filter_worker(void* arg) {
+    filter_arg* a = (filter_arg*)arg;
+    for (;;) {
+        sleep(build_filter(a) ? FILTER_REBUILD_S : FILTER_RETRY_S);
     }
+    return nullptr;
+}
+
+/**
+ * 建立用户名过滤器
+ *
+ * 在后台线程中从数据库读取用户名建立过滤器，本函数立即返回。
+ * 同一线程还检查user表的username列是否有唯一索引（只检查，不修改表结构）。
+ * 过滤器建好并且确认了唯一索引之后，注册时只有过滤器判断可能已被占用才查询数据库，在此之前总是查询。
+ */
+void http_conn::init_filter(string url, string user, string passwd, string db, int port, int close_log) {
+    filter_arg* a = new filter_arg;
+    a->url = url;
+    a->user = user;
+    a->passwd = passwd;
+    a->db = db;
+    a->port = port;
+    a->close_log = close_log;
+    pthread_t tid;
+    if (pthread_create(&tid, nullptr, filter_worker, a) != 0) {
+        int m_close_log = close_log;
+        LOG_ERROR("%s", "failed to start user filter build");
+        delete a;
+        return;
+    }
+    pthread_detach(tid);
+}
+
+void http_conn::get_filter_stats(user_filter_stats& st) {
+    user_names.get_stats(st);
+}
+
+void http_conn::get_insert_stats(group_commit_stats& st) {
+    user_inserts.get_stats(st);
 }
 
 //对文件描述符设置非阻塞
@@ -226,6 +472,9 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     strcpy(sql_passwd, passwd.c_str());
     strcpy(sql_name, sqlname.c_str());
 
+#ifdef ASYNC_DB
+    m_db_seq++;
+#endif
     // 调用重置方法，初始化其他成员变量
     init();
 }
@@ -423,8 +672,8 @@ bool http_conn::add_response(const char* format, ...) {
     // 释放可变参数列表资源
     va_end(arg_list);
     
-    // 记录日志，输出当前请求的响应内容
-    LOG_INFO("request:%s", m_write_buf);
+    // 记录日志，输出当前请求的响应内容，每个响应头都会经过这里，采样记录
+    LOG_INFO_SAMPLED(100, "request:%s", m_write_buf);
     return true;
 }
 // 向HTTP响应中添加状态行
@@ -555,57 +804,87 @@ http_conn::HTTP_CODE http_conn::do_request() {
         strncpy(m_real_file + len, m_url_real,FILENAME_LEN - len - 1);
         free(m_url_real);
 
-        // 提取用户名和密码
+        // 提取用户名和密码，请求体为user=用户名&password=密码，超长的部分截断
         char name[100], password[100];
-        int i; 
-        for (int i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5 ] = '\0';
-
+        int i = 5;
         int j = 0;
-        for (j = i + 10; m_string[i] = '\0'; ++i, ++j) 
-            password[j] = m_string[i];
+        for (; m_string[i] != '\0' && m_string[i] != '&'; ++i) {
+            if (j < (int)sizeof(name) - 1) {
+                name[j++] = m_string[i];
+            }
+        }
+        name[j] = '\0';
+
+        j = 0;
+        if (m_string[i] == '&' && strncmp(m_string + i + 1, "password=", 9) == 0) {
+            for (i = i + 10; m_string[i] != '\0'; ++i) {
+                if (j < (int)sizeof(password) - 1) {
+                    password[j++] = m_string[i];
+                }
+            }
+        }
         password[j] = '\0';
 
         // 处理注册请求
         if (*(p + 1) == '3') {
-            // 检查数据库中是否有同名用户
-            // 若没有，则插入新用户数据
-            char* sql_insert = (char*)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, " INSERT INTO user (username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert,"')");
-
-            if (users.find(name) == users.end()){
-                // 执行数据库插入操作
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string> (name, password));
-                m_lock.unlock();
-
-                // 根据操作结果重定向用户
-                if (!res) {
-                    strcpy(m_url, "/log.html");
+            // 先在users中占下用户名，同名用户同时注册时只有一个能占到；占位不带密码，登录时当作没有缓存。
+            // 插入数据库时不持有锁，成功后才写入密码，失败时把占下的用户名去掉
+            bool reserved = users.reserve(name);
+            // 是否先查询见need_confirm：没有确认唯一索引时总是查询
+            bool confirm = reserved && need_confirm(name);
+
+#ifdef ASYNC_DB
+            // 查询和插入交给事件循环执行，请求挂起，结果到达后在db_done中继续
+            if (reserved && m_async_db) {
+                if (confirm) {
+                    strcpy(m_db_password, password);
                 }
-                else {
-                    strcpy(m_url, "/registerError.html");
+                if (m_async_db->submit(this, m_db_seq, confirm ? SQL_CHECK_USER : SQL_INSERT_USER, name,
+                                       confirm ? nullptr : password)) {
+                    return DB_PENDING;
                 }
-
-
+                register_result(name, nullptr, true, false);
+                return INTERNAL_ERROR;
             }
-            else {
-                // 若已存在同名用户，重定向到注册错误页面
+#endif
+            string stored;
+            int found = confirm ? select_password(name, stored) : 0;
+            if (found > 0) {
+                // 用户已存在，缓存中换成数据库中的密码
+                cache_user(name, stored.data(), stored.size());
                 strcpy(m_url, "/registerError.html");
             }
-
+            else {
+                if (confirm && 0 == found) {
+                    confirmed_absent();
+                }
+                strcpy(m_url, register_result(name, password, reserved, reserved && 0 == found && insert_user(name, password)));
+            }
         }
         // 处理登录请求
         else if (*(p + 1) ==  '2') {
-            // 验证用户名和密码
-            if (users.find(name) != users.end() && users[name] == password) {
+            // 验证用户名和密码，users中没有或已过期时只查数据库中的这一个用户，
+            // 查到的和不存在的都放入users；查询出错时不缓存
+            user_check cached = users.check(name, password);
+            bool known = cached != USER_UNKNOWN;
+            bool match = cached == USER_MATCH;
+
+#ifdef ASYNC_DB
+            if (!known && m_async_db) {
+                strcpy(m_db_password, password);
+                if (m_async_db->submit(this, m_db_seq, SQL_SELECT_PASSWD, name, nullptr)) {
+                    return DB_PENDING;
+                }
+                return INTERNAL_ERROR;
+            }
+#endif
+            string stored;
+            int found = known ? -1 : select_password(name, stored);
+            if (found >= 0) {
+                cache_user(name, found ? stored.data() : nullptr, stored.size());
+                match = found && stored == password;
+            }
+            if (match) {
                 strcpy(m_url, "/welcome.html");
             }
             else {
@@ -663,6 +942,11 @@ http_conn::HTTP_CODE http_conn::do_request() {
             
         }
 
+    return map_file();
+}
+
+// 检查文件是否存在、可读且不是目录，然后映射到内存
+http_conn::HTTP_CODE http_conn::map_file() {
     // 检查文件状态
     if (stat(m_real_file, &m_file_stat) < 0)
         return NO_RESOURCE;
@@ -703,8 +987,8 @@ http_conn::HTTP_CODE http_conn::process_read(){
         text = get_line();
         // 更新下一次解析的起始位置
         m_start_line = m_checked_idx;
-        // 输出日志信息，打印解析的文本行
-        LOG_INFO("%s", text);
+        // 输出日志信息，打印解析的文本行，每个请求行和头部都会经过这里，采样记录
+        LOG_INFO_SAMPLED(100, "%s", text);
 
         // 根据当前的解析状态，分别处理不同的HTTP请求部分
         switch(m_check_state) {
@@ -735,8 +1019,12 @@ http_conn::HTTP_CODE http_conn::process_read(){
                 // 解析请求内容文本，返回解析结果
                 ret = parse_content(text);
                 // 如果解析出错，返回错误
-                if (ret == BAD_REQUEST) 
+                if (ret == BAD_REQUEST)
                     return BAD_REQUEST;
+                // 请求体已完整读入，处理请求
+                else if (ret == GET_REQUEST) {
+                    return do_request();
+                }
                 // 保持行状态为打开，继续解析内容
                 line_status = LINE_OPEN;
                 break;
@@ -867,8 +1155,8 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
         m_host = text;
     }
     else {
-        // 遇到未知的头部信息，记录日志
-        LOG_INFO("oop!unkonw header: %s", text);
+        // 遇到未知的头部信息，记录日志，客户端可以让每个请求都带上，按调用点限速
+        LOG_INFO_RATE(10, "oop!unkonw header: %s", text);
     }
     // 表示请求消息尚未解析完成，需要继续解析更多的数据
     return NO_REQUEST;
@@ -897,6 +1185,57 @@ http_conn::HTTP_CODE http_conn::parse_content(char* text) {
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
 
+// 过载时丢弃请求：不解析请求，把预先生成的503响应放入写缓冲区并注册写事件，
+// 由正常的写流程发送，发送完成后因为不保持连接而关闭
+void http_conn::reply_busy() {
+    memcpy(m_write_buf, BUSY_RESPONSE, BUSY_RESPONSE_LEN);
+    m_write_idx = BUSY_RESPONSE_LEN;
+    m_iv[0].iov_base = m_write_buf;
+    m_iv[0].iov_len = m_write_idx;
+    m_iv_count = 1;
+    bytes_to_send = m_write_idx;
+    bytes_have_send = 0;
+    m_linger = false;
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+}
+
+// 判断请求是否需要访问数据库：与do_request一致，POST且url最后一段以'2'（登录）或'3'（注册）开头
+// 请求行已解析时直接用解析结果，否则在读缓冲区里查看请求行，请求行还不完整时返回false，
+// 这种请求会在数据读完后再次经过分流
+bool http_conn::is_db_request() {
+    if (m_check_state != CHECK_STATE_REQUESTLINE) {
+        if (m_method != POST || !m_url) {
+            return false;
+        }
+        const char* p = strrchr(m_url, '/');
+        return p && (p[1] == '2' || p[1] == '3');
+    }
+
+    if (m_read_idx < 5 || strncasecmp(m_read_buf, "POST", 4) != 0 ||
+        (m_read_buf[4] != ' ' && m_read_buf[4] != '\t')) {
+        return false;
+    }
+    long i = 5;
+    while (i < m_read_idx && (m_read_buf[i] == ' ' || m_read_buf[i] == '\t')) {
+        ++i;
+    }
+    long slash = -1;
+    for (; i < m_read_idx; ++i) {
+        char c = m_read_buf[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            break;
+        }
+        if (c == '/') {
+            slash = i;
+        }
+    }
+    // url还没有读完整
+    if (i >= m_read_idx || slash < 0 || slash + 1 >= i) {
+        return false;
+    }
+    return m_read_buf[slash + 1] == '2' || m_read_buf[slash + 1] == '3';
+}
+
 // 处理HTTP请求的主函数
 // 该函数负责整体控制HTTP请求的读取和写入过程
 void http_conn::process() {
@@ -909,6 +1248,10 @@ void http_conn::process() {
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return;
     }
+    // 等待数据库的请求不注册任何事件，由db_done生成响应
+    if (read_ret == DB_PENDING) {
+        return;
+    }
     
     // 处理写入HTTP响应，并返回写入状态
     bool write_ret = process_write(read_ret);
@@ -922,6 +1265,54 @@ void http_conn::process() {
     modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
 }
 
+#ifdef ASYNC_DB
+// 非阻塞数据库操作完成后在事件循环线程中继续处理挂起的请求
+// 先按结果更新users（不论请求是否还在），再按do_request的方式确定页面、生成响应
+void http_conn::db_done(const sql_async<http_conn>::op& o, bool ok, const char* value, unsigned long len) {
+    const char* page = nullptr;
+    if (SQL_INSERT_USER == o.stmt) {
+        page = register_result(o.params[0], o.params[1], true, ok);
+    }
+    else if (SQL_CHECK_USER == o.stmt) {
+        if (ok && value) {
+            // 用户已存在，缓存中换成数据库中的密码
+            cache_user(o.params[0], value, len);
+            page = "/registerError.html";
+        }
+        else if (!ok || o.seq != m_db_seq) {
+            page = register_result(o.params[0], nullptr, true, false);
+        }
+        else {
+            // 用户名没有被占用，接着插入，请求继续挂起
+            confirmed_absent();
+            if (m_async_db->submit(this, m_db_seq, SQL_INSERT_USER, o.params[0], m_db_password)) {
+                return;
+            }
+            page = register_result(o.params[0], nullptr, true, false);
+        }
+    }
+    else if (ok) {
+        // 查询成功但没有取到值表示数据库中没有该用户
+        cache_user(o.params[0], value, len);
+    }
+    // 等待期间连接超时被关闭，或者连接已被新的客户端复用
+    if (o.seq != m_db_seq) {
+        return;
+    }
+    if (SQL_SELECT_PASSWD == o.stmt) {
+        page = (value && string(value, len) == m_db_password) ? "/welcome.html" : "/logError.html";
+    }
+
+    strcpy(m_url, page);
+    int root_len = strlen(doc_root);
+    strncpy(m_real_file + root_len, m_url, FILENAME_LEN - root_len - 1);
+    if (!process_write(map_file())) {
+        close_conn();
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+}
+#endif
+
 /**
  * 关闭TCP连接的函数
  * 
@@ -940,5 +1331,8 @@ void http_conn::close_conn(bool real_close) {
         m_sockfd = -1;
         // 连接数量减一
         m_user_count--;
+#ifdef ASYNC_DB
+        drop_pending_db();
+#endif
     }
 }
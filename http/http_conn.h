@@ -22,7 +22,11 @@
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/sql_async.h"
+#include "../CGImysql/sql_group_commit.h"
 #include "../log/log.h"
+#include "user_cache.h"
+#include "user_filter.h"
 
 
 // 使用标准命名空间
@@ -35,6 +39,8 @@ public:
     static const int FILENAME_LEN = 200; // 文件名长度
     static const int READ_BUFFER_SIZE = 2048; // 读缓冲区大小
     static const int WRITE_BUFFER_SIZE = 1024; // 写缓冲区大小
+    static const char BUSY_RESPONSE[];        // 过载时返回的完整503响应
+    static const int BUSY_RESPONSE_LEN;       // 503响应的长度
 
     // 定义枚举类型，表示HTTP请求方法
 // 定义HTTP请求方法枚举
@@ -68,7 +74,8 @@ enum METHOD {
         FORBIDDEN_REQUEST, // 请求资源禁止访问
         FILE_REQUEST,    // 请求的资源为文件
         INTERNAL_ERROR,  // 服务器内部错误
-        CLOSED_CONNECTION // 连接已关闭
+        CLOSED_CONNECTION, // 连接已关闭
+        DB_PENDING       // 已提交非阻塞数据库操作，请求挂起到结果到达
     };
 
     // 定义枚举类型，表示解析行的状态（子状态）
@@ -80,7 +87,11 @@ enum METHOD {
 
 public:
     // 默认构造函数
-    http_conn() {}
+    http_conn() {
+#ifdef ASYNC_DB
+        m_db_seq = 0;
+#endif
+    }
     // 默认析构函数
     ~http_conn() {}
 
@@ -95,17 +106,37 @@ public:
     bool read_once();
     // 写数据
     bool write();
+    // 是否为需要访问数据库的请求（登录、注册），用于线程池分流
+    bool is_db_request();
+    // 过载时不处理请求，直接回复503
+    void reply_busy();
 
     // 获取客户端地址
     sockaddr_in* get_address() {
         return &m_address;
     }
-    // 初始化MySQL结果
-    void initmysql_result(connection_pool* connPool);
-    // 定时器标志
-    int timer_flag;
-    // 改进标志
-    int improv;
+    // 设置用户缓存的容量（用户数，0表示不限制），用户在登录时按需查询数据库后缓存
+    static void init_cache(size_t capacity);
+    // 取得用户缓存的运行统计
+    static void get_cache_stats(user_cache_stats& st);
+    // 在后台线程中从数据库读取用户名建立用户名过滤器，之后定期重建，并检查用户名是否有唯一索引，立即返回
+    static void init_filter(string url, string user, string passwd, string db, int port, int close_log);
+    // 取得用户名过滤器的运行统计
+    static void get_filter_stats(user_filter_stats& st);
+    // 取得合并注册的运行统计（使用连接池时）
+    static void get_insert_stats(group_commit_stats& st);
+#ifdef ASYNC_DB
+    // 非阻塞数据库操作完成，在事件循环线程中调用：更新users，请求仍在等待时生成响应并注册写事件
+    void db_done(const sql_async<http_conn>::op& o, bool ok, const char* value, unsigned long len);
+    // 连接已关闭，之后到达的数据库结果不再生成响应。close_conn和定时器关闭连接时调用
+    void drop_pending_db() {
+        m_db_seq++;
+    }
+#endif
+    // 定时器标志，工作线程写入、主线程读取
+    volatile int timer_flag;
+    // 改进标志，工作线程完成读写后置1，主线程在它上面等待
+    volatile int improv;
 
 private:
     // 通用初始化函数
@@ -122,6 +153,12 @@ private:
     HTTP_CODE parse_content(char* text);
     // 执行请求
     HTTP_CODE do_request();
+    // 检查并映射m_real_file指向的文件
+    HTTP_CODE map_file();
+    // 注册新用户，与同时到达的注册合并写入，返回是否插入成功
+    bool insert_user(const char* name, const char* password);
+    // 用预编译语句查询用户的密码，返回1查到，0用户不存在，-1查询出错
+    int select_password(const char* name, string& password);
     
     // 获取当前行指针
     char* get_line() {return m_read_buf + m_start_line;};
@@ -153,6 +190,10 @@ public:
     static int m_user_count;
     // MySQL连接指针
     MYSQL* mysql;
+#ifdef ASYNC_DB
+    // 事件循环中的非阻塞数据库客户端，登录、注册提交到这里后挂起，不占用工作线程
+    static sql_async<http_conn>* m_async_db;
+#endif
     // 状态变量，表示读写状态
     int m_state; 
 
@@ -221,6 +262,12 @@ private:
     char sql_passwd[100];
     // MySQL数据库名
     char sql_name[100];
+#ifdef ASYNC_DB
+    // 每建立或关闭一个连接加一，数据库操作带着提交时的值，结果到达时不相等说明连接已关闭或被复用
+    unsigned int m_db_seq;
+    // 等待查询结果的登录请求的密码，或者等待确认用户名的注册请求的密码
+    char m_db_password[100];
+#endif
   
 };
 
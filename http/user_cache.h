@@ -0,0 +1,491 @@
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <new>
+#include <string>
+
+#include "../lock/locker.h"
+
+// 查询缓存的结果
+enum user_check {
+    USER_UNKNOWN,       // 缓存中没有该用户，或者缓存的结果已过期，需要查数据库
+    USER_ABSENT,        // 不久前查过数据库，没有该用户
+    USER_MISMATCH,      // 用户存在，密码不符
+    USER_MATCH          // 用户存在，密码正确
+};
+
+// 缓存的运行统计
+struct user_cache_stats {
+    size_t users;               // 缓存的用户数，包括不存在的用户
+    size_t capacity;            // 容量，0表示不限制
+    size_t memory;              // 槽位数组和内存区占用的字节数
+    long long hits;             // 命中存在的用户
+    long long absent_hits;      // 命中不存在的用户
+    long long misses;           // 没有命中（包括已过期的）
+    long long expired;          // 其中因为过期没有命中的
+    long long evictions;        // 容量已满时淘汰的用户数
+};
+
+// 用户名到密码的并发缓存，用户按需从数据库查询后放入，不在启动时加载整张表
+// 按哈希值的高位分成SHARDS个分片，每个分片一把读写锁：登录校验只加读锁，可以同时进行，
+// 注册、查询结果写入只锁住一个分片。分片内是开放寻址（线性探测）的槽位数组，每个槽位8字节，
+// 存放哈希值的高32位（标签）和记录在分片内存区中的偏移；用户名和密码紧凑地连续存放在内存区中，
+// 不为每个用户单独分配内存。探测时先比较标签，相同才去内存区比较用户名。
+// 删除在槽位中留下墓碑、在内存区中留下空洞，槽位数组扩容或空洞过多时重建分片，一并回收。
+//
+// 容量有限时每个分片最多缓存capacity/SHARDS个用户，满了按CLOCK算法淘汰：命中时置访问位，
+// 淘汰时指针扫过槽位，清掉访问位的给第二次机会，遇到没有访问位或已过期的就淘汰，
+// 所以内存占用只取决于容量，不随用户表增长。每条记录带过期时间，过期后当作没有缓存，
+// 重新查询数据库并刷新，其他节点的修改最多过ttl秒可见；数据库中没有的用户也缓存一段较短的时间，
+// 反复用不存在的用户名登录不会每次都查数据库。
+//
+// 注册时先用reserve占下用户名，插入数据库成功后再用put写入密码。占位期间查询当作没有缓存，
+// 不会淘汰，同名用户的注册也占不到
+class user_cache {
+public:
+    static const int SHARD_BITS = 6;
+    static const int SHARDS = 1 << SHARD_BITS;
+    static const size_t MAX_LEN = 255;          // 用户名和密码的最大长度，长度各用一字节存放
+    static const uint32_t DEFAULT_TTL_S = 300;  // 存在的用户缓存的时间（秒）
+    static const uint32_t DEFAULT_ABSENT_TTL_S = 10; // 不存在的用户缓存的时间（秒）
+
+    user_cache() : m_capacity(0), m_ttl(DEFAULT_TTL_S), m_absent_ttl(DEFAULT_ABSENT_TTL_S) {}
+
+    ~user_cache() {
+        for (int i = 0; i < SHARDS; i++) {
+            free(m_shards[i].slots);
+            free(m_shards[i].arena);
+        }
+    }
+
+    // 设置容量（用户数，0表示不限制）和缓存时间，需在使用前调用
+    void init(size_t capacity, uint32_t ttl_s = DEFAULT_TTL_S, uint32_t absent_ttl_s = DEFAULT_ABSENT_TTL_S) {
+        m_capacity = capacity;
+        m_ttl = ttl_s;
+        m_absent_ttl = absent_ttl_s;
+        uint32_t per_shard = capacity ? (capacity + SHARDS - 1) / SHARDS : 0;
+        for (int i = 0; i < SHARDS; i++) {
+            m_shards[i].capacity = per_shard;
+        }
+    }
+
+    // 校验用户名和密码，只加读锁，不复制密码
+    user_check check(const char* name, const char* password) {
+        size_t len = strlen(name);
+        if (len > MAX_LEN) {
+            return USER_UNKNOWN;
+        }
+        uint64_t h = hash(name, len);
+        shard& s = shard_of(h);
+        size_t plen = strlen(password);
+        user_check ret = USER_UNKNOWN;
+        s.lock.rdlock();
+        long i = lookup(s, h, name, len);
+        // 注册的占位还没有写入数据库，与没有缓存一样
+        if (i >= 0) {
+            unsigned char* e = (unsigned char*)s.arena + s.slots[i].off;
+            if (expired(e, now_s())) {
+                s.expired.fetch_add(1, std::memory_order_relaxed);
+            }
+            else if (!(e[2] & FLAG_PENDING)) {
+                // 读者之间只会同时写入相同的值，用原子操作避免数据竞争
+                __atomic_or_fetch(&e[2], FLAG_REF, __ATOMIC_RELAXED);
+                if (e[2] & FLAG_ABSENT) {
+                    ret = USER_ABSENT;
+                }
+                else {
+                    ret = (e[1] == plen && memcmp(e + HEADER + len, password, plen) == 0) ? USER_MATCH : USER_MISMATCH;
+                }
+            }
+        }
+        s.lock.unlock();
+        if (USER_UNKNOWN == ret) {
+            s.misses.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (USER_ABSENT == ret) {
+            s.absent_hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            s.hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        return ret;
+    }
+
+    // 取出存在且未过期的用户的密码，否则返回false
+    bool find(const char* name, std::string& password) {
+        size_t len = strlen(name);
+        if (len > MAX_LEN) {
+            return false;
+        }
+        uint64_t h = hash(name, len);
+        shard& s = shard_of(h);
+        s.lock.rdlock();
+        long i = lookup(s, h, name, len);
+        bool found = i >= 0 && live_user((unsigned char*)s.arena + s.slots[i].off, now_s());
+        if (found) {
+            const unsigned char* e = (const unsigned char*)s.arena + s.slots[i].off;
+            password.assign((const char*)e + HEADER + len, e[1]);
+        }
+        s.lock.unlock();
+        return found;
+    }
+
+    // 注册时占下用户名，返回是否占到：已缓存存在且未过期的同名用户或者同名用户正在注册时占不到，过长时也返回false。
+    // 占位不带密码，check和find都当作没有缓存；插入数据库成功后用put写入密码，失败时用erase去掉
+    bool reserve(const char* name) {
+        size_t len = strlen(name);
+        if (len > MAX_LEN) {
+            return false;
+        }
+        uint64_t h = hash(name, len);
+        shard& s = shard_of(h);
+        uint32_t now = now_s();
+        s.lock.wrlock();
+        long i = lookup(s, h, name, len);
+        bool reserved = i < 0 || !taken((unsigned char*)s.arena + s.slots[i].off, now);
+        if (reserved) {
+            if (i >= 0) {
+                remove(s, i);
+            }
+            add(s, h, name, len, nullptr, 0, FLAG_PENDING, now + m_ttl);
+        }
+        s.lock.unlock();
+        return reserved;
+    }
+
+    // 缓存从数据库查到或刚注册的用户，已有的记录（包括占位）被覆盖并重新计时，过长时忽略
+    void put(const char* name, const char* password, size_t plen) {
+        size_t len = strlen(name);
+        if (len > MAX_LEN || plen > MAX_LEN) {
+            return;
+        }
+        uint64_t h = hash(name, len);
+        shard& s = shard_of(h);
+        uint32_t expire = now_s() + m_ttl;
+        s.lock.wrlock();
+        long i = lookup(s, h, name, len);
+        unsigned char* e = i >= 0 ? (unsigned char*)s.arena + s.slots[i].off : nullptr;
+        if (e && e[1] == plen) {
+            // 长度相同时原地覆盖
+            memcpy(e + HEADER + len, password, plen);
+            e[2] &= ~(FLAG_ABSENT | FLAG_PENDING);
+            memcpy(e + 3, &expire, sizeof(expire));
+        }
+        else {
+            if (e) {
+                remove(s, i);
+            }
+            add(s, h, name, len, password, plen, 0, expire);
+        }
+        s.lock.unlock();
+    }
+
+    // 缓存数据库中没有的用户。已缓存存在且未过期的同名用户或者同名用户正在注册时不覆盖：
+    // 可能是查询期间刚注册的，查询结果已经过时
+    void put_absent(const char* name) {
+        size_t len = strlen(name);
+        if (len > MAX_LEN) {
+            return;
+        }
+        uint64_t h = hash(name, len);
+        shard& s = shard_of(h);
+        uint32_t now = now_s();
+        s.lock.wrlock();
+        long i = lookup(s, h, name, len);
+        unsigned char* e = i >= 0 ? (unsigned char*)s.arena + s.slots[i].off : nullptr;
+        if (e == nullptr || !taken(e, now)) {
+            if (e) {
+                remove(s, i);
+            }
+            add(s, h, name, len, nullptr, 0, FLAG_ABSENT, now + m_absent_ttl);
+        }
+        s.lock.unlock();
+    }
+
+    // 删除用户，返回是否缓存了该用户
+    bool erase(const char* name) {
+        size_t len = strlen(name);
+        if (len > MAX_LEN) {
+            return false;
+        }
+        uint64_t h = hash(name, len);
+        shard& s = shard_of(h);
+        s.lock.wrlock();
+        long i = lookup(s, h, name, len);
+        if (i >= 0) {
+            remove(s, i);
+        }
+        s.lock.unlock();
+        return i >= 0;
+    }
+
+    // 缓存的用户数，包括不存在的用户
+    size_t size() {
+        size_t n = 0;
+        for (int i = 0; i < SHARDS; i++) {
+            m_shards[i].lock.rdlock();
+            n += m_shards[i].live;
+            m_shards[i].lock.unlock();
+        }
+        return n;
+    }
+
+    void get_stats(user_cache_stats& st) {
+        memset(&st, 0, sizeof(st));
+        st.capacity = m_capacity;
+        for (int i = 0; i < SHARDS; i++) {
+            shard& s = m_shards[i];
+            s.lock.rdlock();
+            st.users += s.live;
+            st.memory += (s.slots ? (s.mask + 1) * sizeof(slot) : 0) + s.cap;
+            st.evictions += s.evictions;
+            s.lock.unlock();
+            st.hits += s.hits.load(std::memory_order_relaxed);
+            st.absent_hits += s.absent_hits.load(std::memory_order_relaxed);
+            st.misses += s.misses.load(std::memory_order_relaxed);
+            st.expired += s.expired.load(std::memory_order_relaxed);
+        }
+    }
+
+    // FNV-1a，再用murmur3的fmix64打散，使选分片的高位和选槽位的低位都分布均匀；用户名过滤器也用它
+    static uint64_t hash(const char* s, size_t len) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; i++) {
+            h ^= (unsigned char)s[i];
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    static const uint32_t EMPTY = 0xffffffff;   // 槽位为空
+    static const uint32_t TOMB = 0xfffffffe;    // 槽位中的用户已删除
+    static const uint32_t MIN_SLOTS = 16;
+    static const size_t MIN_ARENA = 4096;
+    // 记录头：用户名长度、密码长度、标志各一字节，过期时间4字节（不对齐，用memcpy读写），接着是用户名和密码
+    static const uint32_t HEADER = 7;
+    static const unsigned char FLAG_REF = 1;    // CLOCK访问位
+    static const unsigned char FLAG_ABSENT = 2; // 数据库中没有该用户
+    static const unsigned char FLAG_PENDING = 4; // 注册占下的用户名，还没有写入数据库，没有密码
+
+    struct slot {
+        uint32_t tag;       // 哈希值的高32位，低位同时作为起始槽位
+        uint32_t off;       // 记录在内存区中的偏移，或EMPTY/TOMB
+    };
+
+    // 一个分片，按缓存行对齐，不同分片的锁不会落在同一缓存行
+    struct alignas(64) shard {
+        rwlocker lock;
+        slot* slots;
+        uint32_t mask;      // 槽位数减一，槽位数为2的幂
+        uint32_t live;      // 用户数
+        uint32_t tombs;     // 墓碑数
+        uint32_t capacity;  // 最多缓存的用户数，0表示不限制
+        uint32_t hand;      // CLOCK指针，下一个要检查的槽位
+        char* arena;        // 存放记录的内存区
+        uint32_t used;      // 内存区已用的字节数
+        uint32_t cap;       // 内存区的大小
+        uint32_t dead;      // 已删除记录占用的字节数
+        long long evictions;
+        std::atomic<long long> hits;
+        std::atomic<long long> absent_hits;
+        std::atomic<long long> misses;
+        std::atomic<long long> expired;
+        shard() : slots(nullptr), mask(0), live(0), tombs(0), capacity(0), hand(0), arena(nullptr),
+                  used(0), cap(0), dead(0), evictions(0), hits(0), absent_hits(0), misses(0), expired(0) {}
+    };
+
+    // 单调时钟的秒数，用于过期时间。只需要秒级精度，用粗粒度时钟，每次查询都调用也很便宜
+    static uint32_t now_s() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (uint32_t)ts.tv_sec;
+    }
+
+    static bool expired(const unsigned char* e, uint32_t now) {
+        uint32_t expire;
+        memcpy(&expire, e + 3, sizeof(expire));
+        return (int32_t)(now - expire) >= 0;
+    }
+
+    // 记录是存在且未过期的用户，或者未过期的占位
+    static bool taken(const unsigned char* e, uint32_t now) {
+        return !(e[2] & FLAG_ABSENT) && !expired(e, now);
+    }
+
+    // 记录是存在且未过期的用户
+    static bool live_user(const unsigned char* e, uint32_t now) {
+        return !(e[2] & (FLAG_ABSENT | FLAG_PENDING)) && !expired(e, now);
+    }
+
+    shard& shard_of(uint64_t h) {
+        return m_shards[h >> (64 - SHARD_BITS)];
+    }
+
+    static uint32_t record_size(const char* rec) {
+        return HEADER + (unsigned char)rec[0] + (unsigned char)rec[1];
+    }
+
+    // 查找用户所在的槽位，不存在时返回-1。装载率不超过70%，探测总会遇到空槽位
+    static long lookup(const shard& s, uint64_t h, const char* name, size_t len) {
+        if (s.slots == nullptr) {
+            return -1;
+        }
+        uint32_t tag = (uint32_t)(h >> 32);
+        for (uint32_t i = tag & s.mask; ; i = (i + 1) & s.mask) {
+            const slot& sl = s.slots[i];
+            if (EMPTY == sl.off) {
+                return -1;
+            }
+            if (TOMB != sl.off && sl.tag == tag) {
+                const unsigned char* e = (const unsigned char*)s.arena + sl.off;
+                if (e[0] == len && memcmp(e + HEADER, name, len) == 0) {
+                    return i;
+                }
+            }
+        }
+    }
+
+    // 把记录放进从标签对应位置开始的第一个空槽位或墓碑
+    static void place(shard& s, uint32_t tag, uint32_t off) {
+        uint32_t i = tag & s.mask;
+        while (EMPTY != s.slots[i].off && TOMB != s.slots[i].off) {
+            i = (i + 1) & s.mask;
+        }
+        if (TOMB == s.slots[i].off) {
+            s.tombs--;
+        }
+        s.slots[i].tag = tag;
+        s.slots[i].off = off;
+    }
+
+    static void remove(shard& s, long i) {
+        s.dead += record_size(s.arena + s.slots[i].off);
+        s.slots[i].off = TOMB;
+        s.live--;
+        s.tombs++;
+    }
+
+    // CLOCK淘汰一个用户：已过期或没有访问位的直接淘汰，有访问位的清掉后跳过；未过期的占位不淘汰。
+    // 最多扫两圈，第一圈清掉了所有访问位，第二圈总能找到，除非分片中全是占位，这时暂时超出容量
+    static void evict(shard& s) {
+        uint32_t now = now_s();
+        for (uint32_t n = 0; n < 2 * (s.mask + 1); n++) {
+            uint32_t i = s.hand;
+            s.hand = (s.hand + 1) & s.mask;
+            if (s.slots[i].off >= TOMB) {
+                continue;
+            }
+            unsigned char* e = (unsigned char*)s.arena + s.slots[i].off;
+            if (!expired(e, now) && (e[2] & FLAG_PENDING)) {
+                continue;
+            }
+            if (!expired(e, now) && (e[2] & FLAG_REF)) {
+                e[2] &= ~FLAG_REF;
+                continue;
+            }
+            remove(s, i);
+            s.evictions++;
+            return;
+        }
+    }
+
+    // 用nslots个槽位重建分片：内存区只保留未删除的记录，墓碑全部清除
+    static void rebuild(shard& s, uint32_t nslots) {
+        slot* slots = (slot*)malloc(nslots * sizeof(slot));
+        size_t live_bytes = s.used - s.dead;
+        size_t cap = live_bytes + live_bytes / 2;
+        if (cap < MIN_ARENA) {
+            cap = MIN_ARENA;
+        }
+        char* arena = (char*)malloc(cap);
+        if (slots == nullptr || arena == nullptr) {
+            free(slots);
+            free(arena);
+            throw std::bad_alloc();
+        }
+        memset(slots, 0xff, nslots * sizeof(slot));
+        slot* old = s.slots;
+        uint32_t old_n = old ? s.mask + 1 : 0;
+        char* old_arena = s.arena;
+        s.slots = slots;
+        s.mask = nslots - 1;
+        s.tombs = 0;
+        s.hand = 0;
+        s.arena = arena;
+        s.cap = cap;
+        s.used = 0;
+        s.dead = 0;
+        for (uint32_t i = 0; i < old_n; i++) {
+            if (old[i].off >= TOMB) {
+                continue;
+            }
+            uint32_t size = record_size(old_arena + old[i].off);
+            memcpy(arena + s.used, old_arena + old[i].off, size);
+            place(s, old[i].tag, s.used);
+            s.used += size;
+        }
+        free(old);
+        free(old_arena);
+    }
+
+    // 插入一条不存在的记录，容量已满时先淘汰一个，需要时扩容槽位数组或整理内存区
+    static void add(shard& s, uint64_t h, const char* name, size_t len, const char* password, size_t plen,
+                    unsigned char flags, uint32_t expire) {
+        if (s.capacity && s.live >= s.capacity) {
+            evict(s);
+        }
+        uint32_t nslots = s.slots ? s.mask + 1 : 0;
+        if (nslots == 0) {
+            rebuild(s, MIN_SLOTS);
+        }
+        else if ((uint64_t)(s.live + s.tombs + 1) * 10 > (uint64_t)nslots * 7) {
+            // 主要是墓碑时原大小重建即可
+            rebuild(s, (uint64_t)(s.live + 1) * 10 > (uint64_t)nslots * 7 / 2 ? nslots * 2 : nslots);
+        }
+        uint32_t size = HEADER + len + plen;
+        if (s.used + size > s.cap) {
+            if (s.dead * 2 > s.used) {
+                rebuild(s, s.mask + 1);
+            }
+            if (s.used + size > s.cap) {
+                size_t cap = s.cap * 2;
+                char* arena = (char*)realloc(s.arena, cap);
+                if (arena == nullptr) {
+                    throw std::bad_alloc();
+                }
+                s.arena = arena;
+                s.cap = cap;
+            }
+        }
+        char* e = s.arena + s.used;
+        e[0] = (char)len;
+        e[1] = (char)plen;
+        e[2] = (char)flags;
+        memcpy(e + 3, &expire, sizeof(expire));
+        memcpy(e + HEADER, name, len);
+        if (plen) {
+            memcpy(e + HEADER + len, password, plen);
+        }
+        place(s, (uint32_t)(h >> 32), s.used);
+        s.used += size;
+        s.live++;
+    }
+
+    size_t m_capacity;
+    uint32_t m_ttl;
+    uint32_t m_absent_ttl;
+    shard m_shards[SHARDS];
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef USER_FILTER_H
+#define USER_FILTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "user_cache.h"
+
+// 过滤器的运行统计
+struct user_filter_stats {
+    bool ready;                 // 是否已从数据库建好
+    size_t capacity;            // 按此用户数设计大小，超过后误判率上升，下次重建时按新的用户数调整
+    size_t memory;              // 位数组占用的字节数
+    long long users;            // 最近一次建立时从数据库读到的用户数
+    long long build_ms;         // 最近一次建立的耗时
+    long long builds;           // 建立的次数
+    long long checks;           // 已建好时查询的次数
+    long long negatives;        // 其中确定没有该用户、不需要查数据库的次数
+    long long false_positives;  // 其中判断可能有、数据库中却没有的次数
+};
+
+// 用户名的分块布隆过滤器，注册时判断用户名是否可能已被占用。
+// 只会把没有的判断成可能有（误判），不会把有的判断成没有（其他地方加入、还没有重建进来的用户除外）：
+// 判断没有时可以直接插入数据库，判断可能有时再查询数据库确认。直接插入只在username有唯一索引、
+// 同名用户插入会失败时才安全，没有唯一索引时注册不使用过滤器（见http_conn.cpp的need_confirm）。
+// 位数组按缓存行分块，一个用户名的HASHES个位落在同一块中，每次查询只访问一个缓存行；
+// 每个用户约BITS_PER_USER位，装满时误判率约1%。
+//
+// 位数组由后台线程从数据库逐行读取用户名建立（见http_conn::init_filter），建好之前may_contain总是返回true。
+// 定期重建以包括在其他地方加入的用户、并按用户数调整大小：重建期间add同时写入旧的和正在建立的位数组，
+// 建好后替换旧的。旧的位数组在下一次替换时才释放，此时早已没有线程在读它。
+// 写入位用原子或操作，查询不加锁。
+class user_filter {
+public:
+    static const int BITS_PER_USER = 10;
+    static const int HASHES = 7;                // 每个用户名在块中置的位数
+    static const size_t MIN_CAPACITY = 65536;   // 最小按这么多用户设计大小
+
+    user_filter() : m_cur(nullptr), m_next(nullptr), m_retired(nullptr), m_users(0), m_build_ms(0), m_builds(0),
+                    m_checks(0), m_negatives(0), m_false_positives(0) {}
+
+    ~user_filter() {
+        release(m_cur.load());
+        release(m_next.load());
+        release(m_retired);
+    }
+
+    // 开始建立新的位数组，按users个用户的两倍留出余量。只由建立线程调用
+    void begin_build(size_t users) {
+        size_t capacity = users * 2 > MIN_CAPACITY ? users * 2 : MIN_CAPACITY;
+        size_t blocks = 1;
+        while (blocks * BLOCK_BITS < capacity * BITS_PER_USER) {
+            blocks <<= 1;
+        }
+        table* t = new table;
+        t->mask = blocks - 1;
+        t->capacity = capacity;
+        if (posix_memalign((void**)&t->words, 64, blocks * WORDS_PER_BLOCK * sizeof(uint64_t)) != 0) {
+            delete t;
+            return;
+        }
+        memset(t->words, 0, blocks * WORDS_PER_BLOCK * sizeof(uint64_t));
+        // 先发布再读数据库：此后注册成功的用户同时写入新的位数组，之前注册的已在数据库中，会被读到
+        m_next.store(t, std::memory_order_seq_cst);
+    }
+
+    // 建立时加入从数据库读到的用户名
+    void build_add(const char* name, size_t len) {
+        table* t = m_next.load(std::memory_order_relaxed);
+        if (t) {
+            set(t, user_cache::hash(name, len));
+        }
+    }
+
+    // 读完数据库后用新的位数组替换旧的，失败时丢弃新的
+    void finish_build(bool ok, long long users, long long ms) {
+        table* t = m_next.load(std::memory_order_relaxed);
+        if (t == nullptr) {
+            return;
+        }
+        if (!ok) {
+            m_next.store(nullptr, std::memory_order_seq_cst);
+            // add可能正在写它，与替换下来的一样推迟释放
+            release(m_retired);
+            m_retired = t;
+            return;
+        }
+        table* old = m_cur.exchange(t, std::memory_order_seq_cst);
+        m_next.store(nullptr, std::memory_order_seq_cst);
+        release(m_retired);
+        m_retired = old;
+        m_users.store(users, std::memory_order_relaxed);
+        m_build_ms.store(ms, std::memory_order_relaxed);
+        m_builds.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 加入注册成功的用户，必须在插入数据库成功之后调用
+    // 先取m_next再取m_cur：先取m_cur时，两次读取之间可能正好建好替换（m_cur换成新的、m_next清空），
+    // 用户只写进了旧的位数组。先取m_next时，取到的新位数组之后即使替换上来也已写入；取到空时，
+    // 之后开始的建立会从数据库读到该用户，之前建好的已经是m_cur
+    void add(const char* name) {
+        uint64_t h = user_cache::hash(name, strlen(name));
+        table* next = m_next.load(std::memory_order_seq_cst);
+        table* cur = m_cur.load(std::memory_order_seq_cst);
+        if (next) {
+            set(next, h);
+        }
+        if (cur && cur != next) {
+            set(cur, h);
+        }
+    }
+
+    // 数据库中是否可能有该用户，返回false时一定没有；还没有建好时返回true
+    bool may_contain(const char* name) {
+        table* t = m_cur.load(std::memory_order_acquire);
+        if (t == nullptr) {
+            return true;
+        }
+        uint64_t h = user_cache::hash(name, strlen(name));
+        const uint64_t* w = t->words + block_of(t, h) * WORDS_PER_BLOCK;
+        uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+        bool found = true;
+        for (int i = 0; i < HASHES && found; i++) {
+            uint32_t bit = (h1 + i * h2) & (BLOCK_BITS - 1);
+            found = __atomic_load_n(&w[bit >> 6], __ATOMIC_RELAXED) & (1ULL << (bit & 63));
+        }
+        m_checks.fetch_add(1, std::memory_order_relaxed);
+        if (!found) {
+            m_negatives.fetch_add(1, std::memory_order_relaxed);
+        }
+        return found;
+    }
+
+    // may_contain判断可能有、查询数据库后确认没有时调用，用于统计；还没有建好时不算误判
+    void false_positive() {
+        if (m_cur.load(std::memory_order_relaxed)) {
+            m_false_positives.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void get_stats(user_filter_stats& st) {
+        table* t = m_cur.load(std::memory_order_acquire);
+        st.ready = t != nullptr;
+        st.capacity = t ? t->capacity : 0;
+        st.memory = t ? (t->mask + 1) * WORDS_PER_BLOCK * sizeof(uint64_t) : 0;
+        st.users = m_users.load(std::memory_order_relaxed);
+        st.build_ms = m_build_ms.load(std::memory_order_relaxed);
+        st.builds = m_builds.load(std::memory_order_relaxed);
+        st.checks = m_checks.load(std::memory_order_relaxed);
+        st.negatives = m_negatives.load(std::memory_order_relaxed);
+        st.false_positives = m_false_positives.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const uint32_t BLOCK_BITS = 512;     // 一块为一个缓存行
+    static const int WORDS_PER_BLOCK = BLOCK_BITS / 64;
+
+    struct table {
+        uint64_t* words;
+        uint64_t mask;      // 块数减一，块数为2的幂
+        size_t capacity;
+    };
+
+    // 块号取哈希值乘以黄金比例后的高位，与选块内位的低32位和高32位错开
+    static uint64_t block_of(const table* t, uint64_t h) {
+        return ((h * 0x9e3779b97f4a7c15ULL) >> 32) & t->mask;
+    }
+
+    static void set(table* t, uint64_t h) {
+        uint64_t* w = t->words + block_of(t, h) * WORDS_PER_BLOCK;
+        uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+        for (int i = 0; i < HASHES; i++) {
+            uint32_t bit = (h1 + i * h2) & (BLOCK_BITS - 1);
+            __atomic_or_fetch(&w[bit >> 6], 1ULL << (bit & 63), __ATOMIC_RELAXED);
+        }
+    }
+
+    static void release(table* t) {
+        if (t) {
+            free(t->words);
+            delete t;
+        }
+    }
+
+    std::atomic<table*> m_cur;      // 查询用的位数组，还没有建好时为空
+    std::atomic<table*> m_next;     // 正在建立的位数组
+    table* m_retired;               // 替换下来的位数组，下一次替换时释放
+    std::atomic<long long> m_users;
+    std::atomic<long long> m_build_ms;
+    std::atomic<long long> m_builds;
+    std::atomic<long long> m_checks;
+    std::atomic<long long> m_negatives;
+    std::atomic<long long> m_false_positives;
+};
+
+#endif
@@ -4,6 +4,12 @@
 #include <semaphore.h>
 #include <exception>
 #include <pthread.h>
+#include <atomic>
+#include <climits>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 // 信号量类，用于线程间的同步
 class sem {
@@ -86,6 +92,39 @@ private:
     pthread_mutex_t m_mutex; // 内部互斥锁
 };
 
+// 读写锁类，读多写少的数据用它代替互斥锁，多个读者可以同时持有
+class rwlocker {
+public:
+    // 构造函数：初始化读写锁，失败时抛出异常
+    rwlocker() {
+        if (pthread_rwlock_init(&m_rwlock, nullptr) != 0) {
+            throw std::exception();
+        }
+    }
+
+    // 析构函数：销毁读写锁
+    ~rwlocker() {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+
+    // 以读者身份加锁
+    bool rdlock() {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+
+    // 以写者身份加锁
+    bool wrlock() {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+
+    // 释放读锁或写锁
+    bool unlock() {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+private:
+    pthread_rwlock_t m_rwlock; // 内部读写锁
+};
+
 
 // 条件变量类，提供线程同步机制
 class cond {
@@ -159,4 +198,92 @@ private:
     pthread_cond_t m_cond; // 条件变量
 };
 
+// 事件计数器（eventcount），用于无锁队列的等待与唤醒
+// 消费者先prepare_wait登记并取得当前纪元，再检查一次队列，仍为空才调用wait睡眠；
+// 生产者放入数据后调用notify，只有存在登记的等待者时才进入内核执行futex唤醒，
+// 所以忙碌时生产者和消费者都不会碰任何内核对象
+class eventcount {
+public:
+    eventcount() : m_epoch(0), m_waiters(0), m_wake_calls(0) {}
+
+    // 登记为等待者并返回当前纪元，之后必须调用wait或cancel_wait之一
+    unsigned int prepare_wait() {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    // 登记后发现已有数据，不再等待
+    void cancel_wait() {
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // 纪元未变化时睡眠，直到被notify唤醒
+    void wait(unsigned int key) {
+        while (m_epoch.load(std::memory_order_acquire) == key) {
+            futex((int*)&m_epoch, FUTEX_WAIT_PRIVATE, (int)key, nullptr);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // 带超时的等待，被唤醒返回true，超时返回false
+    bool wait(unsigned int key, int ms_timeout) {
+        struct timespec t;
+        t.tv_sec = ms_timeout / 1000;
+        t.tv_nsec = (ms_timeout % 1000) * 1000000L;
+        bool woken = true;
+        if (m_epoch.load(std::memory_order_acquire) == key) {
+            futex((int*)&m_epoch, FUTEX_WAIT_PRIVATE, (int)key, &t);
+            woken = m_epoch.load(std::memory_order_acquire) != key;
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return woken;
+    }
+
+    // 唤醒一个等待者，没有等待者时只是一次内存读
+    void notify_one() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (0 == m_waiters.load(std::memory_order_relaxed)) {
+            return;
+        }
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        m_wake_calls.fetch_add(1, std::memory_order_relaxed);
+        futex((int*)&m_epoch, FUTEX_WAKE_PRIVATE, 1, nullptr);
+    }
+
+    // 唤醒最多n个等待者
+    void notify_n(int n) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (0 == m_waiters.load(std::memory_order_relaxed)) {
+            return;
+        }
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        m_wake_calls.fetch_add(1, std::memory_order_relaxed);
+        futex((int*)&m_epoch, FUTEX_WAKE_PRIVATE, n, nullptr);
+    }
+
+    // 唤醒全部等待者
+    void notify_all() {
+        notify_n(INT_MAX);
+    }
+
+    // 当前登记的等待者数量
+    int waiters() const {
+        return m_waiters.load(std::memory_order_relaxed);
+    }
+
+    // 累计进入内核执行唤醒的次数
+    long long wake_calls() const {
+        return m_wake_calls.load(std::memory_order_relaxed);
+    }
+
+private:
+    static long futex(int* addr, int op, int val, const struct timespec* timeout) {
+        return syscall(SYS_futex, addr, op, val, timeout, nullptr, 0);
+    }
+
+    std::atomic<unsigned int> m_epoch; // 纪元，每次唤醒加一，futex等待在它上面
+    std::atomic<int> m_waiters;        // 已登记的等待者数量
+    std::atomic<long long> m_wake_calls; // 唤醒系统调用次数，用于统计
+};
+
 #endif
@@ -1,28 +1,88 @@
 #include "log.h"
+#include "../threadpool/affinity.h"
 #include <stdio.h>
 #include <cstring>
+#include <limits.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// 当前线程在每线程缓冲模式下使用的缓冲区组
+static __thread void* t_thread_buffer = nullptr;
 
 Log::Log() {
     m_count = 0;
-    m_is_async = false;
+    m_ring = nullptr;
+    m_mmap = nullptr;
+    m_mode = LOG_MODE_SYNC;
+    m_fp = nullptr;
+    m_stop = false;
+    m_dropped = 0;
+    m_level = LOG_LEVEL_DEBUG;
+    m_file_buf = nullptr;
+    m_last_flush_ms = 0;
+    m_file_bytes = 0;
+    m_file_index = 0;
+    m_cur_path[0] = '\0';
+    m_max_file_bytes = 0;
+    m_max_files = 0;
+    m_compress = false;
+    m_rotate_stop = false;
+    m_rotate_started = false;
+    dir_name[0] = '\0';
 }
 
 Log::~Log() {
+    // 使用环形缓冲区的模式下先让写日志线程写完剩余的日志
+    if (m_ring) {
+        m_stop = true;
+        m_ring->wake();
+        pthread_join(m_flush_tid, nullptr);
+        delete m_ring;
+    }
+    // 每线程缓冲模式下先让后台线程写出剩余的日志
+    if (LOG_MODE_BUFFERED == m_mode) {
+        m_flush_mutex.lock();
+        m_stop = true;
+        m_flush_cond.signal();
+        m_flush_mutex.unlock();
+        pthread_join(m_flush_tid, nullptr);
+        for (size_t i = 0; i < m_thread_buffers.size(); i++) {
+            delete m_thread_buffers[i]->current;
+            delete m_thread_buffers[i]->spare;
+            delete[] m_thread_buffers[i]->line;
+            delete m_thread_buffers[i];
+        }
+        for (size_t i = 0; i < m_free_buffers.size(); i++) {
+            delete m_free_buffers[i];
+        }
+    }
+    // 写日志线程都已退出，不会再分割文件，等后台线程处理完已分割的旧文件
+    if (m_rotate_started) {
+        m_rotate_mutex.lock();
+        m_rotate_stop = true;
+        m_rotate_cond.signal();
+        m_rotate_mutex.unlock();
+        pthread_join(m_rotate_tid, nullptr);
+    }
     if (m_fp != nullptr) {
         fclose(m_fp);
     }
+    delete[] m_file_buf;
+    delete m_mmap;
 }
 
-//异步需要设置阻塞队列长度，同步不需要设置
-bool Log::init(const char* file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size) {
-    // 如果设置了 max_queue_size，则将日志设置为异步模式
-    if (max_queue_size >= 1) {
-        m_is_async = true; // 设置异步标志为 true
-        m_log_queue = new block_queue<string>(max_queue_size); // 创建日志队列，大小为 max_queue_size
-        pthread_t tid;
-        // 创建一个异步线程，用于异步写日志，flush_log_thread 是回调函数
-        pthread_create(&tid, nullptr, flush_log_thread, nullptr);
+//异步需要设置环形缓冲区大小，同步不需要设置
+bool Log::init(const char* file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size, int cpu, int mode, int full_policy) {
+    if (mode < 0 || (LOG_MODE_SYNC != mode && LOG_MODE_BUFFERED != mode && LOG_MODE_MMAP != mode && max_queue_size < 1)) {
+        mode = (max_queue_size >= 1) ? LOG_MODE_ASYNC : LOG_MODE_SYNC;
     }
+    m_mode = mode;
 
     m_close_log = close_log; // 设置日志关闭标志
     m_log_buf_size = log_buf_size; // 设置日志缓冲区大小
@@ -38,30 +98,325 @@ bool Log::init(const char* file_name, int close_log, int log_buf_size, int split
     char log_full_name[256] = {0}; // 日志文件的完整路径和文件名
 
     if (p == nullptr) {
-        // 如果文件名中没有 '/'，直接使用文件名创建日志文件名
+        // 如果文件名中没有 '/'，直接使用文件名创建日志文件名，分割时也在当前目录
+        snprintf(log_name, sizeof(log_name), "%s", file_name);
+        dir_name[0] = '\0';
         snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
     } else {
         // 如果文件名中包含 '/'，将目录和文件名分开
         strcpy(log_name, p + 1); // 提取文件名
         strncpy(dir_name, file_name, p - file_name + 1); // 提取目录名
+        dir_name[p - file_name + 1] = '\0';
         // 创建包含目录和日期的完整日志文件名
         snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
     }
     m_today = my_tm.tm_mday; // 记录日志创建的当天日期
 
-    m_fp = fopen(log_full_name, "a"); // 以追加模式打开日志文件
+    // 内存映射环形文件大小固定、循环覆盖，不按日期命名也不分割；写入的内容进程崩溃后仍在页缓存中，
+    // 不需要后台线程，也不需要崩溃时写出缓冲区
+    if (LOG_MODE_MMAP == m_mode) {
+        m_mmap = new log_mmap();
+        if (!m_mmap->open_write(file_name, m_max_file_bytes > 0 ? m_max_file_bytes : LOG_MMAP_DEFAULT_BYTES)) {
+            delete m_mmap;
+            m_mmap = nullptr;
+            m_mode = LOG_MODE_SYNC;
+            return false;
+        }
+        return true;
+    }
+
+    m_fp = open_file(log_full_name); // 以追加模式打开日志文件
     if (m_fp == nullptr) {
+        m_mode = LOG_MODE_SYNC;
         return false; // 如果文件打开失败，返回 false
     }
+
+    // 分割文件的后台线程
+    pthread_create(&m_rotate_tid, nullptr, rotate_thread, nullptr);
+    m_rotate_started = true;
+
+    // 文件打开后再创建后台写日志线程
+    if (LOG_MODE_BUFFERED == m_mode) {
+        // 每线程缓冲模式：创建线程退出时回收缓冲区的key和后台写日志线程
+        pthread_key_create(&m_buffer_key, release_thread_buffer);
+        pthread_create(&m_flush_tid, nullptr, buffered_log_thread, nullptr);
+    }
+    else if (LOG_MODE_ASYNC == m_mode || LOG_MODE_DEFERRED == m_mode || LOG_MODE_BINARY == m_mode) {
+        // 每条记录能容纳一整行日志，与同步模式一样最长log_buf_size字节；
+        // 延迟格式化和二进制模式下记录中是原始参数，字符串参数超出记录大小的部分被截断
+        m_ring = new log_ring(max_queue_size, m_log_buf_size, full_policy);
+        pthread_create(&m_flush_tid, nullptr, flush_log_thread, nullptr);
+    }
+    if (LOG_MODE_SYNC != m_mode && cpu >= 0) {
+        pin_thread(m_flush_tid, cpu);
+    }
+
+    // 日志不再每行刷新，进程崩溃时由信号处理函数写出缓冲区中剩余的日志
+    if (0 == m_close_log) {
+        struct sigaction sa;
+        memset(&sa, '\0', sizeof(sa));
+        sa.sa_handler = crash_handler;
+        sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+        for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+            sigaction(signals[i], &sa, nullptr);
+        }
+    }
     return true; // 文件打开成功，返回 true
 }
 
+FILE* Log::open_file(const char* name) {
+    int fd = open(name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+    FILE* fp = fdopen(fd, "a");
+    if (fp == nullptr) {
+        close(fd);
+        return nullptr;
+    }
+    struct stat st;
+    m_file_bytes = (0 == fstat(fd, &st)) ? st.st_size : 0;
+    snprintf(m_cur_path, sizeof(m_cur_path), "%s", name);
+    // 每个文件有自己的缓冲区，旧文件在后台线程中关闭时还要用到它
+    m_file_buf = new char[LOG_FLUSH_BYTES];
+    setvbuf(fp, m_file_buf, _IOFBF, LOG_FLUSH_BYTES);
+    // 二进制日志每个文件段以魔数开头，之后的格式串定义重新写出
+    if (LOG_MODE_BINARY == m_mode) {
+        fwrite(log_format::LOG_BINARY_MAGIC, 1, sizeof(log_format::LOG_BINARY_MAGIC), fp);
+        m_file_bytes += sizeof(log_format::LOG_BINARY_MAGIC);
+        m_formats.clear();
+    }
+    return fp;
+}
+
+// ERROR级别立即刷新，其余级别距上次刷新超过LOG_FLUSH_INTERVAL_MS时刷新；
+// 达到LOG_FLUSH_BYTES时stdio的全缓冲会自动写文件
+void Log::flush_if_needed(int level, long long now_ms) {
+    if (3 == level || now_ms - m_last_flush_ms >= LOG_FLUSH_INTERVAL_MS) {
+        fflush(m_fp);
+        m_last_flush_ms = now_ms;
+    }
+}
+
+// 异步写日志线程：被唤醒或等待超时后取出环形缓冲区中的全部记录写入文件，
+// 每写完一批唤醒等待空闲槽位的生产者；行数统计和文件分割也在这里完成，生产者不需要加锁
+void* Log::async_write_log() {
+    while (true) {
+        m_ring->wait(LOG_FLUSH_INTERVAL_MS);
+        bool stop = m_stop;
+
+        struct timeval now = {0, 0};
+        gettimeofday(&now, nullptr);
+        time_t t = now.tv_sec;
+        struct tm my_tm;
+        localtime_r(&t, &my_tm);
+        int level = 0;
+        int n = 0;
+        m_mutex.lock();
+        log_ring::record* r;
+        while ((r = m_ring->take()) != nullptr) {
+            rotate_if_needed(my_tm);
+            m_file_bytes += write_record(r);
+            m_count++;
+            if (r->level > level) {
+                level = r->level;
+            }
+            m_ring->release(r);
+            if (0 == ++n % 64) {
+                m_ring->notify_space();
+            }
+        }
+        m_ring->notify_space();
+        // 本批有ERROR日志时立即刷新，否则按时间间隔刷新
+        flush_if_needed(level, now.tv_sec * 1000LL + now.tv_usec / 1000);
+        m_mutex.unlock();
+
+        if (stop && 0 == m_ring->size()) {
+            break;
+        }
+    }
+    return nullptr;
+}
+
+// 异步模式下记录已是格式化好的一行；延迟格式化模式在这里格式化；
+// 二进制模式写出原始记录，格式串第一次出现在当前文件段时先写出它的定义
+int Log::write_record(const log_ring::record* r) {
+    if (LOG_MODE_ASYNC == m_mode) {
+        fwrite(r->data, 1, r->len, m_fp);
+        return r->len;
+    }
+    else if (LOG_MODE_DEFERRED == m_mode) {
+        const char* fmt = (const char*)(uintptr_t)log_format::record_format(r->data);
+        int n = log_format::format_line(r->level, r->data, r->len, fmt, m_buf, m_log_buf_size);
+        fwrite(m_buf, 1, n, m_fp);
+        return n;
+    }
+    int bytes = 0;
+    uint64_t fmt = log_format::record_format(r->data);
+    if (m_formats.insert(fmt).second) {
+        const char* s = (const char*)(uintptr_t)fmt;
+        uint16_t len = (uint16_t)strnlen(s, UINT16_MAX);
+        fputc('F', m_fp);
+        fwrite(&fmt, 1, 8, m_fp);
+        fwrite(&len, 1, 2, m_fp);
+        fwrite(s, 1, len, m_fp);
+        bytes += 11 + len;
+    }
+    uint16_t len = (uint16_t)r->len;
+    fputc('R', m_fp);
+    fputc(r->level, m_fp);
+    fwrite(&len, 1, 2, m_fp);
+    fwrite(r->data, 1, len, m_fp);
+    return bytes + 4 + len;
+}
+
+// 异步模式下写一行日志：占下环形缓冲区的一个槽位，直接格式化进去后发布，全程不加锁
+void Log::ring_write(int level, const char* format, va_list valst) {
+    static const char* levels[] = {"[debug]", "[info]:", "[warn]:", "[erro]:"};
+    const char* s = (level >= 0 && level <= 3) ? levels[level] : levels[1];
+
+    log_ring::record* r = m_ring->claim();
+    if (!r) {
+        return;
+    }
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    time_t t = now.tv_sec;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    int size = m_ring->record_size();
+    int n = snprintf(r->data, size, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+    int m = vsnprintf(r->data + n, size - n - 1, format, valst);
+    // 超长的日志截断到记录大小
+    if (m < 0) {
+        m = 0;
+    }
+    else if (m > size - n - 2) {
+        m = size - n - 2;
+    }
+    r->data[n + m] = '\n';
+    r->len = n + m + 1;
+    r->level = level;
+    m_ring->publish(r);
+}
+
+// 内存映射环形文件模式下写一行日志：在栈上格式化后复制进映射的文件，全程不加锁也没有系统调用
+void Log::mmap_write(int level, const char* format, va_list valst) {
+    static const char* levels[] = {"[debug]", "[info]:", "[warn]:", "[erro]:"};
+    const char* s = (level >= 0 && level <= 3) ? levels[level] : levels[1];
+
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    time_t t = now.tv_sec;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    char line[LOG_MMAP_MAX_LINE];
+    int size = m_log_buf_size < LOG_MMAP_MAX_LINE ? m_log_buf_size : LOG_MMAP_MAX_LINE;
+    int n = snprintf(line, size, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+    int m = vsnprintf(line + n, size - n - 1, format, valst);
+    // 超长的日志截断到行的最大长度
+    if (m < 0) {
+        m = 0;
+    }
+    else if (m > size - n - 2) {
+        m = size - n - 2;
+    }
+    line[n + m] = '\n';
+    m_mmap->append(level, line, n + m + 1);
+}
+
+void Log::crash_handler(int sig) {
+    Log::get_instance()->flush_on_crash();
+    // SA_RESETHAND已恢复默认处理方式，重新触发信号让进程按原来的方式终止（生成core等）
+    raise(sig);
+}
+
+// 崩溃时其他线程可能正持有锁或正在写日志，这里不加锁，也不调用stdio等非异步信号安全的函数，只用write写出。
+// 只做尽力而为的写出：正在写的一行可能被截断或与其他线程的输出交错，
+// 写日志线程在此期间刷新stdio缓冲区时，其中的内容可能重复出现
+void Log::flush_on_crash() {
+    if (!m_fp) {
+        return;
+    }
+    int fd = fileno(m_fp);
+    if (LOG_MODE_BUFFERED == m_mode) {
+        for (size_t i = 0; i < m_thread_buffers.size(); i++) {
+            thread_buffer* tb = m_thread_buffers[i];
+            for (size_t j = 0; j < tb->full.size(); j++) {
+                if (write(fd, tb->full[j]->data, tb->full[j]->len) < 0) {
+                    return;
+                }
+            }
+            if (tb->current && tb->current->len > 0 && write(fd, tb->current->data, tb->current->len) < 0) {
+                return;
+            }
+        }
+        return;
+    }
+    // 异步模式下先关闭环形缓冲区，写日志线程不再取新的记录，剩余的记录只由这里取出，不会写两遍
+    if (LOG_MODE_ASYNC == m_mode) {
+        m_ring->close();
+    }
+    // 写出stdio缓冲区中还没刷到文件的部分，不能调用fflush，直接读glibc的缓冲区指针
+#ifdef __GLIBC__
+    char* base = m_fp->_IO_write_base;
+    char* ptr = m_fp->_IO_write_ptr;
+    if (base && ptr > base && write(fd, base, ptr - base) < 0) {
+        return;
+    }
+#endif
+    // 异步模式下再写出环形缓冲区中已发布但还没写入文件的记录，其他模式的记录需要格式化，这里不处理
+    if (LOG_MODE_ASYNC == m_mode) {
+        log_ring::record* r;
+        while ((r = m_ring->take_closed()) != nullptr) {
+            if (write(fd, r->data, r->len) < 0) {
+                return;
+            }
+        }
+    }
+}
+
 void Log::write_log(int level, const char* format, ...) {
+    // 每线程缓冲、异步和内存映射环形文件模式不经过下面的全局锁和共享缓冲区
+    if (LOG_MODE_BUFFERED == m_mode || LOG_MODE_ASYNC == m_mode || LOG_MODE_MMAP == m_mode) {
+        va_list valst;
+        va_start(valst, format);
+        if (LOG_MODE_BUFFERED == m_mode) {
+            buffered_write(level, format, valst);
+        }
+        else if (LOG_MODE_MMAP == m_mode) {
+            mmap_write(level, format, valst);
+        }
+        else {
+            ring_write(level, format, valst);
+        }
+        va_end(valst);
+        return;
+    }
+    // 延迟格式化和二进制模式下日志宏走append，直接调用write_log时先格式化，再作为一个字符串参数记录
+    if (LOG_MODE_DEFERRED == m_mode || LOG_MODE_BINARY == m_mode) {
+        char line[1024];
+        va_list valst;
+        va_start(valst, format);
+        vsnprintf(line, sizeof(line), format, valst);
+        va_end(valst);
+        append(level, "%s", line);
+        return;
+    }
+
     struct timeval now = {0, 0};  // 定义一个时间结构体，用于存储当前时间
     gettimeofday(&now, nullptr);  // 获取当前时间，精确到微秒
     time_t t = now.tv_sec;  // 提取当前时间的秒部分
-    struct tm *sys_tm = localtime(&t);  // 将秒部分转换为本地时间的tm结构
-    struct tm my_tm = *sys_tm;  // 将sys_tm赋值给my_tm
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);  // 将秒部分转换为本地时间的tm结构，多个线程同时写日志，要用可重入版本
     char s[16] = {0};  // 定义一个字符数组s，用于存储日志级别字符串
     switch (level) {
         case 0:
@@ -82,29 +437,8 @@ void Log::write_log(int level, const char* format, ...) {
     }
     
     m_mutex.lock();  // 加锁，确保多线程环境下对共享资源的安全访问
+    rotate_if_needed(my_tm);
     m_count++;  // 日志计数器加1
-
-    // 检查是否需要新建日志文件
-    if(m_today != my_tm.tm_mday || m_count & m_split_lines == 0) {
-        char new_log[256] = {0};  // 定义一个字符数组，用于存储新日志文件名
-        fflush(m_fp);  // 刷新文件缓冲区，将数据写入文件
-        fclose(m_fp);  // 关闭当前日志文件
-        char tail[16] = {0};  // 定义一个字符数组，用于存储日期信息
-
-        // 格式化日期信息
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-        if (m_today != my_tm.tm_mday) {
-            // 如果是新的一天，则新建一个新的日志文件
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;  // 更新当前日期
-            m_count = 0;  // 重置日志计数器
-        } else {
-            // 如果是同一天，但日志数量达到了分割行数，则创建一个新文件
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
-        }
-        m_fp = fopen(new_log, "a");  // 打开新日志文件，追加模式
-    }
-
     m_mutex.unlock();  // 解锁
 
     va_list valst;  // 定义一个可变参数列表
@@ -120,28 +454,451 @@ void Log::write_log(int level, const char* format, ...) {
     
     // 将可变参数列表格式化并写入缓冲区
     int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
+    // 超长的日志截断到缓冲区大小
+    if (m < 0) {
+        m = 0;
+    }
+    else if (m > m_log_buf_size - n - 2) {
+        m = m_log_buf_size - n - 2;
+    }
     m_buf[n + m] = '\n';  // 添加换行符
     m_buf[n + m + 1] = '\0';  // 以空字符结束字符串
     log_str = m_buf;  // 将缓冲区内容转换为字符串
 
     m_mutex.unlock();  // 解锁
 
-    if (m_is_async && !m_log_queue->full()) {
-        // 如果是异步模式且日志队列未满，则将日志推入队列
-        m_log_queue->push(log_str);
-    } else {
-        // 如果是同步模式或日志队列已满，则直接写入日志文件
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);  // 将日志字符串写入文件
-        m_mutex.unlock();
-    }
+    // 同步模式直接写入日志文件
+    m_mutex.lock();
+    fputs(log_str.c_str(), m_fp);  // 将日志字符串写入文件
+    m_file_bytes += log_str.size();
+    flush_if_needed(level, now.tv_sec * 1000LL + now.tv_usec / 1000);
+    m_mutex.unlock();
 
     va_end(valst);  // 结束可变参数列表
 
 }
 
 void Log::flush(void) {
+    // 内存映射环形文件由内核写回
+    if (LOG_MODE_MMAP == m_mode) {
+        return;
+    }
+    if (LOG_MODE_BUFFERED == m_mode) {
+        m_flush_cond.signal();
+        return;
+    }
     m_mutex.lock();  // 加锁
     fflush(m_fp);  // 刷新文件缓冲区，将数据写入文件
     m_mutex.unlock();  // 解锁
 }
+
+// 检查是否需要新建日志文件，调用者需持有m_mutex
+// 持锁期间只打开新文件（一次open），旧文件交给后台线程关闭、压缩和清理
+void Log::rotate_if_needed(const struct tm& my_tm) {
+    bool new_day = m_today != my_tm.tm_mday;
+    bool by_lines = m_split_lines > 0 && m_count >= m_split_lines;
+    bool by_size = m_max_file_bytes > 0 && m_file_bytes >= m_max_file_bytes;
+    if (!new_day && !by_lines && !by_size) {
+        return;
+    }
+    char new_log[256] = {0};  // 定义一个字符数组，用于存储新日志文件名
+    char tail[16] = {0};  // 定义一个字符数组，用于存储日期信息
+
+    // 格式化日期信息
+    snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+    if (new_day) {
+        // 如果是新的一天，则新建一个新的日志文件
+        snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
+        m_today = my_tm.tm_mday;  // 更新当前日期
+        m_file_index = 0;
+    } else {
+        // 如果是同一天，但日志行数或大小达到了上限，则创建一个新文件
+        // 跳过已存在的序号（包括已压缩的），重启后不会追加到已分割的文件或覆盖压缩文件
+        struct stat st;
+        char gz[264];
+        do {
+            m_file_index++;
+            snprintf(new_log, 255, "%s%s%s.%d", dir_name, tail, log_name, m_file_index);
+            snprintf(gz, sizeof(gz), "%s.gz", new_log);
+        } while (0 == stat(new_log, &st) || 0 == stat(gz, &st));
+    }
+
+    rotated_file old;
+    old.fp = m_fp;
+    old.buf = m_file_buf;
+    old.path = m_cur_path;
+    FILE* fp = open_file(new_log);  // 打开新日志文件，追加模式
+    m_count = 0;  // 重置日志计数器
+    if (fp == nullptr) {
+        // 打开失败时继续写旧文件，等下次达到上限再试
+        m_file_buf = old.buf;
+        m_file_bytes = 0;
+        snprintf(m_cur_path, sizeof(m_cur_path), "%s", old.path.c_str());
+        return;
+    }
+    m_fp = fp;
+    old.current = m_cur_path;
+    m_rotate_mutex.lock();
+    m_rotated.push_back(old);
+    m_rotate_cond.signal();
+    m_rotate_mutex.unlock();
+}
+
+// 后台线程：关闭分割出的旧文件（写出它的stdio缓冲区），按策略压缩并清理超出保留数的文件
+void Log::rotate_work() {
+    while (true) {
+        m_rotate_mutex.lock();
+        while (m_rotated.empty() && !m_rotate_stop) {
+            m_rotate_cond.wait(m_rotate_mutex.get());
+        }
+        if (m_rotated.empty()) {
+            m_rotate_mutex.unlock();
+            break;
+        }
+        rotated_file f = m_rotated.front();
+        m_rotated.erase(m_rotated.begin());
+        m_rotate_mutex.unlock();
+
+        fclose(f.fp);
+        delete[] f.buf;
+        if (m_compress) {
+            compress_file(f.path);
+        }
+        // 还有排队的旧文件时先不清理，它们尚未压缩，不能按修改时间与压缩好的文件比较
+        m_rotate_mutex.lock();
+        bool idle = m_rotated.empty();
+        m_rotate_mutex.unlock();
+        if (m_max_files > 0 && idle) {
+            remove_old_files(f.current);
+        }
+    }
+}
+
+// 压缩结果追加到"文件名.gz"而不是覆盖：gzip格式允许多段拼接，同名文件被再次分割时不会丢失之前的内容
+void Log::compress_file(const string& path) {
+    string gz = path + ".gz";
+    int out = open(gz.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (out < 0) {
+        return;
+    }
+    struct stat st;
+    off_t before = (0 == fstat(out, &st)) ? st.st_size : 0;
+    struct stat src;
+    if (stat(path.c_str(), &src) < 0) {
+        close(out);
+        return;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    char* argv[] = {(char*)"gzip", (char*)"-c", (char*)path.c_str(), nullptr};
+    pid_t pid;
+    int status = -1;
+    bool ok = 0 == posix_spawnp(&pid, "gzip", &actions, nullptr, argv, environ) &&
+              waitpid(pid, &status, 0) == pid && WIFEXITED(status) && 0 == WEXITSTATUS(status);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (ok) {
+        // 压缩文件沿用原文件的修改时间，清理时按它排序
+        struct timespec times[2] = {src.st_atim, src.st_mtim};
+        futimens(out, times);
+        unlink(path.c_str());
+    }
+    else if (0 == before) {
+        // 压缩失败保留原文件
+        unlink(gz.c_str());
+    }
+    else if (ftruncate(out, before) < 0) {
+        // 去掉写了一半的压缩段失败，原文件仍保留
+    }
+    close(out);
+}
+
+bool Log::is_log_file(const char* name) const {
+    // 日期前缀 yyyy_mm_dd_
+    static const char pattern[] = "dddd_dd_dd_";
+    for (int i = 0; pattern[i]; i++) {
+        if ('d' == pattern[i] ? (name[i] < '0' || name[i] > '9') : name[i] != pattern[i]) {
+            return false;
+        }
+    }
+    const char* rest = name + sizeof(pattern) - 1;
+    size_t len = strlen(log_name);
+    if (0 != strncmp(rest, log_name, len)) {
+        return false;
+    }
+    rest += len;
+    // 可选的 .序号
+    if ('.' == rest[0] && rest[1] >= '0' && rest[1] <= '9') {
+        rest++;
+        while (*rest >= '0' && *rest <= '9') {
+            rest++;
+        }
+    }
+    return 0 == strcmp(rest, "") || 0 == strcmp(rest, ".gz");
+}
+
+void Log::remove_old_files(const string& current) {
+    string dir = dir_name[0] ? dir_name : "./";
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    const char* cur = strrchr(current.c_str(), '/');
+    cur = cur ? cur + 1 : current.c_str();
+    vector<pair<long long, string> > files;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != nullptr) {
+        if (!is_log_file(entry->d_name) || 0 == strcmp(entry->d_name, cur)) {
+            continue;
+        }
+        string path = dir + entry->d_name;
+        struct stat st;
+        if (0 == stat(path.c_str(), &st)) {
+            files.push_back(make_pair((long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec, path));
+        }
+    }
+    closedir(d);
+    if ((int)files.size() <= m_max_files) {
+        return;
+    }
+    sort(files.begin(), files.end());
+    for (size_t i = 0; i + m_max_files < files.size(); i++) {
+        unlink(files[i].second.c_str());
+    }
+}
+
+// 取得当前线程的缓冲区组，第一次调用时创建并登记到m_thread_buffers
+Log::thread_buffer* Log::get_thread_buffer() {
+    thread_buffer* tb = (thread_buffer*)t_thread_buffer;
+    if (tb) {
+        return tb;
+    }
+    tb = new thread_buffer;
+    tb->current = alloc_buffer();
+    tb->spare = alloc_buffer();
+    tb->line = new char[m_log_buf_size];
+    tb->cached_sec = 0;
+    tb->exited = false;
+    m_threads_mutex.lock();
+    m_thread_buffers.push_back(tb);
+    m_threads_mutex.unlock();
+    t_thread_buffer = tb;
+    pthread_setspecific(m_buffer_key, tb);
+    return tb;
+}
+
+// 线程退出时调用，只做标记，缓冲区组由后台线程写出剩余内容后释放
+void Log::release_thread_buffer(void* arg) {
+    thread_buffer* tb = (thread_buffer*)arg;
+    tb->mutex.lock();
+    tb->exited = true;
+    tb->mutex.unlock();
+}
+
+Log::log_buffer* Log::alloc_buffer() {
+    log_buffer* buf = nullptr;
+    m_free_mutex.lock();
+    if (!m_free_buffers.empty()) {
+        buf = m_free_buffers.back();
+        m_free_buffers.pop_back();
+    }
+    m_free_mutex.unlock();
+    if (!buf) {
+        buf = new log_buffer;
+    }
+    buf->len = 0;
+    buf->lines = 0;
+    return buf;
+}
+
+// 每线程缓冲模式下写一行日志
+// 时间前缀按秒缓存，同一秒内只格式化微秒部分；格式化在线程私有的行缓冲区中完成，
+// 然后追加到本线程的current缓冲区，写满时换上备用缓冲区并唤醒后台线程
+void Log::buffered_write(int level, const char* format, va_list valst) {
+    static const char* levels[] = {"[debug]", "[info]:", "[warn]:", "[erro]:"};
+    const char* s = (level >= 0 && level <= 3) ? levels[level] : levels[1];
+    thread_buffer* tb = get_thread_buffer();
+
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec != tb->cached_sec) {
+        time_t t = now.tv_sec;
+        struct tm my_tm;
+        localtime_r(&t, &my_tm);
+        snprintf(tb->cached_time, sizeof(tb->cached_time), "%d-%02d-%02d %02d:%02d:%02d",
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                 my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+        tb->cached_sec = now.tv_sec;
+    }
+
+    int n = snprintf(tb->line, m_log_buf_size, "%s.%06ld %s ", tb->cached_time, now.tv_usec, s);
+    int m = vsnprintf(tb->line + n, m_log_buf_size - n - 1, format, valst);
+    // 超长的日志截断到行缓冲区大小
+    if (m < 0) {
+        m = 0;
+    }
+    else if (m > m_log_buf_size - n - 2) {
+        m = m_log_buf_size - n - 2;
+    }
+    tb->line[n + m] = '\n';
+    int len = n + m + 1;
+
+    bool wake = false;
+    tb->mutex.lock();
+    if (tb->current->len + len > LOG_BUFFER_SIZE) {
+        // 写盘跟不上，积压的缓冲区太多，丢弃这一行
+        if ((int)tb->full.size() >= LOG_MAX_FULL_BUFFERS) {
+            tb->mutex.unlock();
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        tb->full.push_back(tb->current);
+        if (tb->spare) {
+            tb->current = tb->spare;
+            tb->spare = nullptr;
+        }
+        else {
+            tb->current = alloc_buffer();
+        }
+        wake = true;
+    }
+    memcpy(tb->current->data + tb->current->len, tb->line, len);
+    tb->current->len += len;
+    tb->current->lines++;
+    tb->mutex.unlock();
+
+    // ERROR级别的日志立即唤醒后台线程写出
+    if (wake || 3 == level) {
+        m_flush_cond.signal();
+    }
+}
+
+// 收集所有线程已写满的缓冲区和正在写的缓冲区，换上空缓冲区，然后在锁外一次writev写出
+// 不同线程的日志按线程分块写出，文件中的行只在同一线程内保持时间顺序
+void Log::write_buffers() {
+    m_pending.clear();
+    m_threads_mutex.lock();
+    for (size_t i = 0; i < m_thread_buffers.size(); ) {
+        thread_buffer* tb = m_thread_buffers[i];
+        tb->mutex.lock();
+        m_pending.insert(m_pending.end(), tb->full.begin(), tb->full.end());
+        tb->full.clear();
+        if (tb->current->len > 0) {
+            m_pending.push_back(tb->current);
+            tb->current = tb->exited ? nullptr : alloc_buffer();
+        }
+        if (!tb->spare && !tb->exited) {
+            tb->spare = alloc_buffer();
+        }
+        bool exited = tb->exited;
+        tb->mutex.unlock();
+
+        // 线程已退出，剩余内容已经取走，释放它的缓冲区组
+        if (exited) {
+            m_free_mutex.lock();
+            if (tb->current) {
+                m_free_buffers.push_back(tb->current);
+            }
+            if (tb->spare) {
+                m_free_buffers.push_back(tb->spare);
+            }
+            m_free_mutex.unlock();
+            delete[] tb->line;
+            delete tb;
+            m_thread_buffers[i] = m_thread_buffers.back();
+            m_thread_buffers.pop_back();
+            continue;
+        }
+        i++;
+    }
+    m_threads_mutex.unlock();
+
+    if (m_pending.empty()) {
+        return;
+    }
+
+    time_t t = time(nullptr);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    m_mutex.lock();
+    rotate_if_needed(my_tm);
+    for (size_t i = 0; i < m_pending.size(); i++) {
+        m_count += m_pending[i]->lines;
+        m_file_bytes += m_pending[i]->len;
+    }
+    int fd = fileno(m_fp);
+    struct iovec iov[64];
+    for (size_t i = 0; i < m_pending.size(); ) {
+        int cnt = 0;
+        size_t bytes = 0;
+        for (; cnt < 64 && i + cnt < m_pending.size(); cnt++) {
+            iov[cnt].iov_base = m_pending[i + cnt]->data;
+            iov[cnt].iov_len = m_pending[i + cnt]->len;
+            bytes += m_pending[i + cnt]->len;
+        }
+        // writev可能只写出一部分，调整iovec后继续写
+        struct iovec* p = iov;
+        int left = cnt;
+        while (bytes > 0) {
+            ssize_t ret = writev(fd, p, left);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            bytes -= ret;
+            while (left > 0 && (size_t)ret >= p->iov_len) {
+                ret -= p->iov_len;
+                p++;
+                left--;
+            }
+            if (left > 0) {
+                p->iov_base = (char*)p->iov_base + ret;
+                p->iov_len -= ret;
+            }
+        }
+        i += cnt;
+    }
+    m_mutex.unlock();
+
+    // 缓冲区放回空闲池，池里只保留够每个线程换一次的数量，多余的释放
+    m_free_mutex.lock();
+    for (size_t i = 0; i < m_pending.size(); i++) {
+        if (m_free_buffers.size() < m_thread_buffers.size() * 2 + 4) {
+            m_free_buffers.push_back(m_pending[i]);
+        }
+        else {
+            delete m_pending[i];
+        }
+    }
+    m_free_mutex.unlock();
+    m_pending.clear();
+}
+
+// 后台线程：每LOG_FLUSH_INTERVAL_MS毫秒、有缓冲区写满或有ERROR日志时写出一次，退出前把剩余日志全部写出
+void Log::buffered_write_log() {
+    while (true) {
+        m_flush_mutex.lock();
+        if (!m_stop) {
+            struct timespec t;
+            clock_gettime(CLOCK_REALTIME, &t);
+            t.tv_sec += LOG_FLUSH_INTERVAL_MS / 1000;
+            t.tv_nsec += (LOG_FLUSH_INTERVAL_MS % 1000) * 1000000L;
+            if (t.tv_nsec >= 1000000000L) {
+                t.tv_sec++;
+                t.tv_nsec -= 1000000000L;
+            }
+            m_flush_cond.timewait(m_flush_mutex.get(), t);
+        }
+        bool stop = m_stop;
+        m_flush_mutex.unlock();
+
+        write_buffers();
+        if (stop) {
+            break;
+        }
+    }
+}
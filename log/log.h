@@ -3,16 +3,80 @@
 
 #include <iostream>
 #include <string>
-#include "block_queue.h"
+#include <vector>
+#include <atomic>
+#include <sys/time.h>
+#include <unordered_set>
+#include "log_ring.h"
+#include "log_format.h"
+#include "log_mmap.h"
 #include <cstdarg>
 
 using namespace std;
 
+// 日志级别，数值越大越重要
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// 编译期最低日志级别，低于它的日志宏展开为空，调用和参数求值都不存在，如make LOG_MIN_LEVEL=2只保留WARN和ERROR
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// 日志调用点的限速状态，由LOG_*_RATE宏在每个调用点定义一个静态实例
+// 按秒计数，每秒最多放行per_sec条，其余只计数，下一条放行的日志带上被压制的条数
+class log_rate_limiter {
+public:
+    // 返回是否记录这条日志，返回true时suppressed为上次记录以来被压制的条数
+    bool allow(int per_sec, long long& suppressed) {
+        long long now = time(nullptr);
+        long long window = m_window.load(std::memory_order_relaxed);
+        if (window != now && m_window.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+            m_count.store(0, std::memory_order_relaxed);
+        }
+        if (m_count.fetch_add(1, std::memory_order_relaxed) < per_sec) {
+            suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    std::atomic<long long> m_window{0};     // 当前计数的秒
+    std::atomic<int> m_count{0};            // 本秒内的调用次数
+    std::atomic<long long> m_suppressed{0}; // 上次记录以来被压制的条数
+};
+
 /**
  * 日志类，用于记录程序运行时的日志信息
  */
 class Log{
 public:
+    // 写日志方式
+    enum LOG_MODE {
+        LOG_MODE_SYNC = 0,    // 同步，调用线程直接写文件
+        LOG_MODE_ASYNC,       // 异步，每行日志直接格式化进无锁环形缓冲区，由写日志线程取出写文件
+        LOG_MODE_BUFFERED,    // 每线程双缓冲，调用线程只追加到自己的缓冲区，后台线程定期交换缓冲区并一次writev写出
+        LOG_MODE_DEFERRED,    // 延迟格式化，调用线程只把格式串指针和原始参数存入环形缓冲区，由写日志线程格式化为文本
+        LOG_MODE_BINARY,      // 二进制，与延迟格式化相同，但写日志线程直接写出原始记录，用log_decode离线格式化
+        LOG_MODE_MMAP         // 内存映射环形文件，调用线程把格式化好的一行直接复制进映射的文件，没有后台线程，用log_dump查看
+    };
+
+    // 每线程缓冲模式下单个缓冲区的大小
+    static const int LOG_BUFFER_SIZE = 64 * 1024;
+    // 每个线程最多积压的写满缓冲区数，超过后丢弃日志并计数，避免写盘跟不上时内存无限增长
+    static const int LOG_MAX_FULL_BUFFERS = 16;
+    // 刷新策略：距上次刷新超过LOG_FLUSH_INTERVAL_MS毫秒，或缓冲的日志达到LOG_FLUSH_BYTES字节时写入文件，
+    // ERROR级别的日志立即写入；进程崩溃时由信号处理函数尽量写出缓冲区中剩余的日志
+    static const int LOG_FLUSH_INTERVAL_MS = 1000;
+    static const int LOG_FLUSH_BYTES = 64 * 1024;
+    // 内存映射环形文件模式下一行日志的最大长度，以及未设置文件大小时环形文件数据区的大小
+    static const int LOG_MMAP_MAX_LINE = 4096;
+    static const long long LOG_MMAP_DEFAULT_BYTES = 64LL << 20;
+
     /**
      * 获取日志类的单例实例
      * @return 返回日志类的单例指针
@@ -28,20 +92,47 @@ public:
      * @return 返回nullptr
      */
     static void* flush_log_thread(void* args) {
+        (void)args;
         Log::get_instance()->async_write_log();
         return nullptr;
     }
 
+    /**
+     * 分割文件后台线程入口函数，负责关闭、压缩旧文件和清理超出保留数的文件
+     * @param args 线程参数，未使用
+     * @return 返回nullptr
+     */
+    static void* rotate_thread(void* args) {
+        (void)args;
+        Log::get_instance()->rotate_work();
+        return nullptr;
+    }
+
+    /**
+     * 每线程缓冲模式下的后台写日志线程入口函数
+     * @param args 线程参数，未使用
+     * @return 返回nullptr
+     */
+    static void* buffered_log_thread(void* args) {
+        (void)args;
+        Log::get_instance()->buffered_write_log();
+        return nullptr;
+    }
+
     /**
      * 初始化日志类
      * @param file_name 日志文件名
      * @param close_log 是否关闭日志
      * @param log_buf_size 日志缓冲区大小，默认为8192
      * @param split_lines 日志文件分割行数，默认为5000000
-     * @param max_queue_size 日志队列最大大小，默认为0表示不限制
+     * @param max_queue_size 异步、延迟格式化和二进制模式下环形缓冲区的日志条数，默认为0表示同步
+     * @param cpu 异步写日志线程绑定的CPU，默认为-1表示不绑核
+     * @param mode 写日志方式，见LOG_MODE，默认为-1表示由max_queue_size决定：大于0为异步，否则同步
+     * @param full_policy 异步模式下环形缓冲区满时的处理方式，见log_ring::full_policy，默认阻塞等待
      * @return 返回初始化是否成功
      */
-    bool init(const char* file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    bool init(const char* file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0, int cpu = -1, int mode = -1,
+              int full_policy = log_ring::FULL_BLOCK);
 
     /**
      * 写入日志
@@ -51,11 +142,79 @@ public:
      */
     void write_log(int level, const char* format, ...);
 
+    /**
+     * 设置文件分割和保留策略，需在init之前调用
+     * @param max_file_bytes 单个日志文件的最大字节数，超过后分割出新文件，0表示不按大小分割；
+     *                       内存映射环形文件模式下是环形文件的大小，0表示LOG_MMAP_DEFAULT_BYTES
+     * @param max_files 最多保留的已分割日志文件数（含压缩后的），超过时删除最旧的，0表示不限制
+     * @param compress 是否在后台用gzip压缩分割出来的旧文件
+     */
+    void set_rotation_policy(long long max_file_bytes, int max_files, bool compress) {
+        m_max_file_bytes = max_file_bytes;
+        m_max_files = max_files;
+        m_compress = compress;
+    }
+
+    /**
+     * 设置运行时日志级别，低于该级别的日志宏直接跳过，可以在运行中随时调用
+     * @param level LOG_LEVEL_DEBUG到LOG_LEVEL_ERROR，超出范围的值被截断
+     */
+    void set_level(int level) {
+        if (level < LOG_LEVEL_DEBUG) {
+            level = LOG_LEVEL_DEBUG;
+        }
+        else if (level > LOG_LEVEL_ERROR) {
+            level = LOG_LEVEL_ERROR;
+        }
+        m_level.store(level, std::memory_order_relaxed);
+    }
+
+    int get_level() const {
+        return m_level.load(std::memory_order_relaxed);
+    }
+
+    // 该级别的日志是否需要记录，日志宏在格式化参数之前调用
+    bool enabled(int level) const {
+        return level >= m_level.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * 日志宏的入口：延迟格式化和二进制模式下只记录格式串指针和参数，其他模式转给write_log
+     * 延迟格式化模式要求format是字符串字面量等在进程内一直有效的字符串
+     */
+    template <typename... Args>
+    void append(int level, const char* format, Args... args) {
+        if (LOG_MODE_DEFERRED == m_mode || LOG_MODE_BINARY == m_mode) {
+            log_ring::record* r = m_ring->claim();
+            if (!r) {
+                return;
+            }
+            log_format::encoder e(r->data, m_ring->record_size());
+            e.header(format);
+            log_format::encode_args(e, args...);
+            r->len = e.size();
+            r->level = level;
+            m_ring->publish(r);
+        }
+        else {
+            write_log(level, format, args...);
+        }
+    }
+
     /**
      * 刷新日志，将缓冲区内容写入文件
+     * 写日志时已按刷新策略自动刷新，这里用于空闲时定期调用，避免最后几行日志长时间留在缓冲区；
+     * 每线程缓冲模式下只唤醒后台线程
      */
     void flush(void);
 
+    /**
+     * 因积压过多被丢弃的日志行数（每线程缓冲模式，或异步模式下缓冲区满且策略为丢弃）
+     */
+    long long dropped() const {
+        return m_dropped.load(std::memory_order_relaxed) + (m_ring ? m_ring->dropped() : 0);
+    }
+
 private:
     Log();
     virtual ~Log();
@@ -64,38 +223,183 @@ private:
      * 异步写入日志线程函数
      * @return 返回nullptr
      */
-    void* async_write_log() {
-        string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while(m_log_queue->pop(single_log)) {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    void* async_write_log();
+
+    // 异步模式下把一行日志格式化进环形缓冲区
+    void ring_write(int level, const char* format, va_list valst);
+
+    // 内存映射环形文件模式下格式化一行日志并写入映射的文件
+    void mmap_write(int level, const char* format, va_list valst);
+
+    // 写日志线程写出一条环形缓冲区中的记录，调用者需持有m_mutex，返回写出的字节数
+    int write_record(const log_ring::record* r);
+
+    // 每线程缓冲模式使用的固定大小缓冲区
+    struct log_buffer {
+        int len;    // 已写入的字节数
+        int lines;  // 已写入的行数，用于按行数分割文件
+        char data[LOG_BUFFER_SIZE];
+    };
+
+    // 每个写日志线程私有的缓冲区组，锁只在本线程追加和后台线程交换时使用，基本没有竞争
+    struct thread_buffer {
+        locker mutex;
+        log_buffer* current;            // 正在追加的缓冲区
+        log_buffer* spare;              // 备用缓冲区，current写满时直接换上，不用分配
+        vector<log_buffer*> full;       // 已写满等待后台线程写出的缓冲区
+        char* line;                     // 格式化单行日志用的缓冲区
+        time_t cached_sec;              // 时间前缀缓存对应的秒数
+        char cached_time[72];           // 缓存的"年-月-日 时:分:秒"前缀，按6个int字段的最大宽度留足空间
+        bool exited;                    // 所属线程已退出，后台线程写出剩余内容后释放
+    };
+
+    // 分割出去等待后台线程处理的旧文件
+    struct rotated_file {
+        FILE* fp;           // 旧文件，由后台线程关闭，关闭时写出stdio缓冲区中剩余的内容
+        char* buf;          // 旧文件的stdio缓冲区，关闭后释放
+        string path;        // 旧文件路径
+        string current;     // 分割时的新文件路径，清理旧文件时跳过
+    };
+
+    // 检查是否需要新建日志文件（跨天、达到分割行数或大小），调用者需持有m_mutex，在写入之前调用
+    // 这里只打开新文件并换上，旧文件的关闭、压缩和清理交给后台线程，不阻塞持有m_mutex的写日志线程
+    void rotate_if_needed(const struct tm& my_tm);
+
+    // 以O_APPEND方式打开日志文件，并设置LOG_FLUSH_BYTES大小的全缓冲，使stdio按字节数阈值写文件
+    // 成功时m_file_buf、m_file_bytes和m_cur_path更新为新文件的
+    FILE* open_file(const char* name);
+
+    // 分割文件后台线程主循环
+    void rotate_work();
+
+    // 用gzip把文件压缩追加到"文件名.gz"，成功后删除原文件
+    void compress_file(const string& path);
+
+    // 删除超出保留数的已分割日志文件，按修改时间从旧到新删除
+    void remove_old_files(const string& current);
+
+    // 文件名是否为本日志分割出的文件：日期_日志名[.序号][.gz]
+    bool is_log_file(const char* name) const;
+
+    // 按刷新策略决定是否刷新文件缓冲区，调用者需持有m_mutex
+    void flush_if_needed(int level, long long now_ms);
+
+    // 崩溃信号处理函数：尽量写出缓冲区中的日志，然后按默认方式重新触发信号
+    static void crash_handler(int sig);
+
+    // 在信号处理函数中写出剩余日志，不加锁，只用write，只做尽力而为的写出，输出可能截断或交错
+    void flush_on_crash();
+
+    // 每线程缓冲模式下格式化并追加一行日志
+    void buffered_write(int level, const char* format, va_list valst);
+
+    // 取得当前线程的缓冲区组，第一次调用时创建并登记
+    thread_buffer* get_thread_buffer();
+
+    // 从空闲缓冲区池中取一个缓冲区，池为空时新分配
+    log_buffer* alloc_buffer();
+
+    // 收集所有线程的缓冲区并一次writev写出，之后把缓冲区放回空闲池
+    void write_buffers();
+
+    // 每线程缓冲模式的后台线程主循环
+    void buffered_write_log();
+
+    // 线程退出时由pthread_key的析构函数调用，标记该线程的缓冲区组待回收
+    static void release_thread_buffer(void* arg);
 
 private:
     char dir_name[128]; //日志目录名
     char log_name[128]; //日志文件名
     int m_split_lines; //日志文件分割行数
     int m_log_buf_size; //日志缓冲区大小
-    long long m_count; //日志计数
+    long long m_count; //当前文件的日志行数
     int m_today; //当日志
+    long long m_file_bytes; //当前文件的字节数
+    int m_file_index; //当天按行数或大小分割出的文件序号
+    char m_cur_path[256]; //当前日志文件路径
+    long long m_max_file_bytes; //单个文件最大字节数，0表示不按大小分割
+    int m_max_files; //最多保留的已分割文件数，0表示不限制
+    bool m_compress; //是否压缩分割出的旧文件
+    vector<rotated_file> m_rotated; //等待后台线程处理的旧文件
+    locker m_rotate_mutex; //保护m_rotated和m_rotate_stop
+    cond m_rotate_cond; //有旧文件或需要退出时唤醒后台线程
+    pthread_t m_rotate_tid; //分割文件后台线程
+    bool m_rotate_stop; //通知后台线程处理完剩余文件后退出
+    bool m_rotate_started; //后台线程是否已创建
     FILE* m_fp; //文件指针
     char* m_buf; //缓冲区
-    block_queue<string> *m_log_queue; //阻塞队列，用于异步写日志
-    bool m_is_async; //是否异步写日志
+    log_ring* m_ring; //异步模式下的无锁环形缓冲区
+    log_mmap* m_mmap; //内存映射环形文件模式下映射的文件
     locker m_mutex; //线程锁
     int m_close_log; //是否关闭日志
+    int m_mode; //写日志方式
+    char* m_file_buf; //日志文件的stdio缓冲区
+    unordered_set<uint64_t> m_formats; //二进制模式下当前文件段已写出定义的格式串
+    long long m_last_flush_ms; //上次刷新文件缓冲区的时间
+
+    // 以下用于每线程缓冲模式
+    vector<thread_buffer*> m_thread_buffers; //所有线程的缓冲区组
+    locker m_threads_mutex; //保护m_thread_buffers
+    vector<log_buffer*> m_free_buffers; //空闲缓冲区池
+    locker m_free_mutex; //保护m_free_buffers
+    vector<log_buffer*> m_pending; //后台线程本轮要写出的缓冲区
+    pthread_key_t m_buffer_key; //用于在线程退出时回收缓冲区组
+    pthread_t m_flush_tid; //后台写日志线程
+    locker m_flush_mutex; //与m_flush_cond配合
+    cond m_flush_cond; //有缓冲区写满或需要退出时唤醒后台线程
+    std::atomic<bool> m_stop; //通知后台线程写出剩余日志后退出
+    std::atomic<long long> m_dropped; //因积压过多被丢弃的日志行数
+    std::atomic<int> m_level; //运行时日志级别
 };
 
+// 日志宏只写日志不刷新，何时写入文件由Log的刷新策略决定，ERROR级别立即写入
+// 运行时低于Log::get_level()的日志只多一次原子读，不格式化也不进入缓冲区
+// 每个请求都会经过的调用点用采样或限速的日志宏，保留可见性的同时避免日志量随请求数增长：
+// LOG_*_SAMPLED(n, ...)  每个线程每n次记录一次，行尾注明采样率；运行时级别为DEBUG时不采样，每次都记录
+// LOG_*_RATE(per_sec, ...) 每个调用点每秒最多记录per_sec条，行尾注明上次记录以来被压制的条数；运行时级别为DEBUG时不限速
+#define LOG_SAMPLED_IMPL(level, n, format, ...) if(0 == m_close_log && Log::get_instance()->enabled(level)) { \
+    static __thread int log_sample_count = 0; \
+    if (LOG_LEVEL_DEBUG == Log::get_instance()->get_level()) {Log::get_instance()->append(level, format, ##__VA_ARGS__);} \
+    else if (++log_sample_count >= (n)) {log_sample_count = 0; Log::get_instance()->append(level, format " [sampled 1/%d]", ##__VA_ARGS__, (int)(n));}}
+#define LOG_RATE_IMPL(level, per_sec, format, ...) if(0 == m_close_log && Log::get_instance()->enabled(level)) { \
+    static log_rate_limiter log_limiter; \
+    long long log_suppressed = 0; \
+    if (LOG_LEVEL_DEBUG == Log::get_instance()->get_level() || log_limiter.allow(per_sec, log_suppressed)) { \
+        if (0 == log_suppressed) {Log::get_instance()->append(level, format, ##__VA_ARGS__);} \
+        else {Log::get_instance()->append(level, format " [%lld suppressed]", ##__VA_ARGS__, log_suppressed);}}}
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
 // 定义DEBUG级别日志宏，当m_close_log为0时，记录DEBUG级别日志
-#define LOG_DEBUG(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+#define LOG_DEBUG(format, ...) if(0 == m_close_log && Log::get_instance()->enabled(LOG_LEVEL_DEBUG)) {Log::get_instance()->append(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__);}
+#define LOG_DEBUG_SAMPLED(n, format, ...) LOG_SAMPLED_IMPL(LOG_LEVEL_DEBUG, n, format, ##__VA_ARGS__)
+#define LOG_DEBUG_RATE(per_sec, format, ...) LOG_RATE_IMPL(LOG_LEVEL_DEBUG, per_sec, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...)
+#define LOG_DEBUG_SAMPLED(n, format, ...)
+#define LOG_DEBUG_RATE(per_sec, format, ...)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
 // 定义INFO级别日志宏，当m_close_log为0时，记录INFO级别日志
-#define LOG_INFO(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+#define LOG_INFO(format, ...) if(0 == m_close_log && Log::get_instance()->enabled(LOG_LEVEL_INFO)) {Log::get_instance()->append(LOG_LEVEL_INFO, format, ##__VA_ARGS__);}
+#define LOG_INFO_SAMPLED(n, format, ...) LOG_SAMPLED_IMPL(LOG_LEVEL_INFO, n, format, ##__VA_ARGS__)
+#define LOG_INFO_RATE(per_sec, format, ...) LOG_RATE_IMPL(LOG_LEVEL_INFO, per_sec, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...)
+#define LOG_INFO_SAMPLED(n, format, ...)
+#define LOG_INFO_RATE(per_sec, format, ...)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
 // 定义WARN级别日志宏，当m_close_log为0时，记录WARN级别日志
-#define LOG_WARN(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-// 定义ERROR级别日志宏，当m_close_log为0时，记录ERROR级别日志
-#define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+#define LOG_WARN(format, ...) if(0 == m_close_log && Log::get_instance()->enabled(LOG_LEVEL_WARN)) {Log::get_instance()->append(LOG_LEVEL_WARN, format, ##__VA_ARGS__);}
+#define LOG_WARN_SAMPLED(n, format, ...) LOG_SAMPLED_IMPL(LOG_LEVEL_WARN, n, format, ##__VA_ARGS__)
+#define LOG_WARN_RATE(per_sec, format, ...) LOG_RATE_IMPL(LOG_LEVEL_WARN, per_sec, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...)
+#define LOG_WARN_SAMPLED(n, format, ...)
+#define LOG_WARN_RATE(per_sec, format, ...)
+#endif
+// 定义ERROR级别日志宏，当m_close_log为0时，记录ERROR级别日志，ERROR不受级别过滤
+#define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->append(LOG_LEVEL_ERROR, format, ##__VA_ARGS__);}
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,82 @@
+// 二进制日志解码工具：把-l 4写出的二进制日志格式化为与文本日志相同的格式，输出到标准输出
+// 用法：./log_decode 2024_09_03_ServerLog.bin [更多文件...]，不带参数时从标准输入读取
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include "log_format.h"
+
+using namespace std;
+
+// 解码一个文件，返回是否完整读完
+static bool decode(FILE* in, const char* name) {
+    unordered_map<uint64_t, string> formats;
+    char record[65536];
+    char line[65536 + 64];
+    char magic[sizeof(log_format::LOG_BINARY_MAGIC)];
+    bool started = false;
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+        if ('F' == c) {
+            uint64_t id;
+            uint16_t len;
+            if (fread(&id, 1, 8, in) != 8 || fread(&len, 1, 2, in) != 2 || fread(record, 1, len, in) != len) {
+                break;
+            }
+            formats[id] = string(record, len);
+        }
+        else if ('R' == c) {
+            int level = fgetc(in);
+            uint16_t len;
+            if (EOF == level || fread(&len, 1, 2, in) != 2 || fread(record, 1, len, in) != len) {
+                break;
+            }
+            unordered_map<uint64_t, string>::iterator it = formats.find(log_format::record_format(record));
+            const char* fmt = (it != formats.end()) ? it->second.c_str() : "(unknown format)";
+            int n = log_format::format_line(level, record, len, fmt, line, sizeof(line));
+            fwrite(line, 1, n, stdout);
+        }
+        else if (log_format::LOG_BINARY_MAGIC[0] == c) {
+            // 新的文件段，之前的格式串定义作废
+            magic[0] = (char)c;
+            if (fread(magic + 1, 1, sizeof(magic) - 1, in) != sizeof(magic) - 1 ||
+                memcmp(magic, log_format::LOG_BINARY_MAGIC, sizeof(magic)) != 0) {
+                break;
+            }
+            formats.clear();
+            started = true;
+        }
+        else {
+            break;
+        }
+        if (!started) {
+            break;
+        }
+    }
+    if (!feof(in)) {
+        fprintf(stderr, "%s: corrupt or truncated at offset %ld\n", name, ftell(in));
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        return decode(stdin, "stdin") ? 0 : 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; i++) {
+        FILE* in = fopen(argv[i], "rb");
+        if (!in) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        if (!decode(in, argv[i])) {
+            ret = 1;
+        }
+        fclose(in);
+    }
+    return ret;
+}
@@ -0,0 +1,110 @@
+// 内存映射环形日志文件读取工具：按写入顺序导出-l 5写出的环形文件中仍保留的日志，输出到标准输出
+// 用法：./log_dump [-n 行数] [-f] ServerLog.ring
+//   -n 只输出最后若干行
+//   -f 输出完已有的日志后继续跟踪新写入的日志，类似tail -f
+// 可以在服务器运行中读取，也可以在进程崩溃后读取，写到一半的记录会被跳过
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <deque>
+#include "log_mmap.h"
+
+using namespace std;
+
+// 写日志的线程在记录提交前被挂起时，跟踪模式下等待它写完的最长时间
+static const int PENDING_WAIT_MS = 100;
+
+int main(int argc, char* argv[]) {
+    bool follow = false;
+    long tail = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "fn:")) != -1) {
+        switch (opt) {
+        case 'f':
+            follow = true;
+            break;
+        case 'n':
+            tail = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n lines] [-f] file\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-n lines] [-f] file\n", argv[0]);
+        return 1;
+    }
+    log_mmap ring;
+    if (!ring.open_read(argv[optind])) {
+        fprintf(stderr, "%s: not a log ring file\n", argv[optind]);
+        return 1;
+    }
+
+    static char line[65536];
+    uint64_t capacity = ring.capacity();
+    uint64_t end = ring.write_pos();
+    // 最早的记录可能已被部分覆盖，从一整圈之前开始找到第一个完整的记录
+    uint64_t pos = end > capacity ? end - capacity : 0;
+    deque<string> last;
+    int waited = 0;
+    while (true) {
+        if (pos >= end) {
+            if (tail >= 0) {
+                for (size_t i = 0; i < last.size(); i++) {
+                    fwrite(last[i].data(), 1, last[i].size(), stdout);
+                }
+                last.clear();
+                tail = -1;
+            }
+            if (!follow) {
+                break;
+            }
+            fflush(stdout);
+            while ((end = ring.write_pos()) == pos) {
+                usleep(10000);
+            }
+            continue;
+        }
+
+        uint32_t len;
+        int level;
+        uint64_t next;
+        if (ring.read(pos, line, sizeof(line), len, level, next)) {
+            if (len > 0) {
+                if (tail < 0) {
+                    fwrite(line, 1, len, stdout);
+                }
+                else if (tail > 0) {
+                    last.push_back(string(line, len));
+                    if ((long)last.size() > tail) {
+                        last.pop_front();
+                    }
+                }
+            }
+            pos = next;
+            waited = 0;
+            continue;
+        }
+
+        // 读得太慢被写日志的一方追上一圈，跳到仍保留的最早位置
+        uint64_t now = ring.write_pos();
+        if (now > capacity && pos < now - capacity) {
+            fprintf(stderr, "log_dump: overrun, skipped %llu bytes\n", (unsigned long long)(now - capacity - pos));
+            pos = now - capacity;
+            waited = 0;
+            continue;
+        }
+        // 跟踪模式下最新的记录可能正在写，稍等再读；否则是崩溃留下的半条记录或不在记录开头，向后寻找下一条记录
+        if (follow && waited < PENDING_WAIT_MS && pos + capacity / 2 > now) {
+            usleep(1000);
+            waited++;
+            continue;
+        }
+        pos += 8;
+        waited = 0;
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <type_traits>
+
+// 延迟格式化日志的记录格式，写日志的线程只保存格式串指针和原始参数，格式化由后台线程或离线的log_decode完成
+// 一条记录：[8字节时间戳(微秒)][8字节格式串指针][参数...]，每个参数是[1字节类型][值]，
+// 整数统一存为8字节，浮点数存为double，字符串复制内容存为[2字节长度][字节]，指针存为8字节
+//
+// 二进制日志文件由若干段组成，每段以LOG_BINARY_MAGIC开头（打开或分割文件时写入），段内是：
+//   'F' [8字节格式串指针][2字节长度][格式串]   格式串定义，同一段内每个格式串只出现一次
+//   'R' [1字节级别][2字节长度][记录]          一条日志记录
+// 格式串指针只在写入它的进程内有意义，所以每段都重新写出用到的格式串
+namespace log_format {
+
+static const char LOG_BINARY_MAGIC[8] = {'W', 'S', 'B', 'L', 'O', 'G', '1', '\n'};
+
+enum arg_type {
+    ARG_INT = 1,    // 有符号整数
+    ARG_UINT,       // 无符号整数
+    ARG_DOUBLE,     // 浮点数
+    ARG_STR,        // 字符串
+    ARG_PTR         // 其他指针
+};
+
+// 把一条记录编码到固定大小的缓冲区中，空间不够时丢弃后面的参数，格式化时按缺失处理
+class encoder {
+public:
+    encoder(char* buf, int size) : m_p(buf), m_begin(buf), m_end(buf + size) {}
+
+    void header(const char* format) {
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        int64_t us = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+        uint64_t fmt = (uint64_t)(uintptr_t)format;
+        memcpy(m_p, &us, 8);
+        memcpy(m_p + 8, &fmt, 8);
+        m_p += 16;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type put(T v) {
+        if (std::is_signed<T>::value || std::is_enum<T>::value) {
+            put_value(ARG_INT, (int64_t)v);
+        }
+        else {
+            put_value(ARG_UINT, (uint64_t)v);
+        }
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type put(T v) {
+        put_value(ARG_DOUBLE, (double)v);
+    }
+
+    void put(const char* s) {
+        if (!s) {
+            s = "(null)";
+        }
+        if (m_end - m_p < 3) {
+            return;
+        }
+        size_t len = strlen(s);
+        if (len > (size_t)(m_end - m_p - 3)) {
+            len = m_end - m_p - 3;
+        }
+        uint16_t n = (uint16_t)len;
+        *m_p = ARG_STR;
+        memcpy(m_p + 1, &n, 2);
+        memcpy(m_p + 3, s, n);
+        m_p += 3 + n;
+    }
+
+    void put(char* s) {
+        put((const char*)s);
+    }
+
+    void put(const void* p) {
+        put_value(ARG_PTR, (uint64_t)(uintptr_t)p);
+    }
+
+    int size() const {
+        return m_p - m_begin;
+    }
+
+private:
+    template <typename V>
+    void put_value(char type, V v) {
+        if (m_end - m_p < (int)(1 + sizeof(V))) {
+            return;
+        }
+        *m_p = type;
+        memcpy(m_p + 1, &v, sizeof(V));
+        m_p += 1 + sizeof(V);
+    }
+
+    char* m_p;
+    char* m_begin;
+    char* m_end;
+};
+
+// 依次编码全部参数
+inline void encode_args(encoder&) {}
+
+template <typename T, typename... Args>
+void encode_args(encoder& e, T v, Args... args) {
+    e.put(v);
+    encode_args(e, args...);
+}
+
+// 解码出的一个参数
+struct arg_value {
+    int type;
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char* s;
+    int len;
+};
+
+// 从记录中依次读出参数
+class decoder {
+public:
+    decoder(const char* p, const char* end) : m_p(p), m_end(end) {}
+
+    bool next(arg_value& v) {
+        if (m_p >= m_end) {
+            return false;
+        }
+        v.type = *m_p++;
+        v.i = 0;
+        v.u = 0;
+        v.d = 0;
+        v.s = "";
+        v.len = 0;
+        switch (v.type) {
+            case ARG_INT:
+            case ARG_UINT:
+            case ARG_PTR:
+                if (m_end - m_p < 8) {
+                    return false;
+                }
+                memcpy(&v.u, m_p, 8);
+                v.i = (int64_t)v.u;
+                v.d = (ARG_INT == v.type) ? (double)v.i : (double)v.u;
+                m_p += 8;
+                return true;
+            case ARG_DOUBLE:
+                if (m_end - m_p < 8) {
+                    return false;
+                }
+                memcpy(&v.d, m_p, 8);
+                v.i = (int64_t)v.d;
+                v.u = (uint64_t)v.i;
+                m_p += 8;
+                return true;
+            case ARG_STR: {
+                uint16_t n;
+                if (m_end - m_p < 2) {
+                    return false;
+                }
+                memcpy(&n, m_p, 2);
+                if (m_end - m_p - 2 < n) {
+                    return false;
+                }
+                v.s = m_p + 2;
+                v.len = n;
+                m_p += 2 + n;
+                return true;
+            }
+            default:
+                m_p = m_end;
+                return false;
+        }
+    }
+
+private:
+    const char* m_p;
+    const char* m_end;
+};
+
+// 按格式串和解码出的参数格式化日志内容，每个转换说明单独调用一次snprintf
+// 返回写入out的字节数（不含结尾的'\0'），缺失或类型不符的参数输出为"(?)"
+inline int format_args(const char* fmt, const char* args, int args_len, char* out, int size) {
+    decoder dec(args, args + args_len);
+    int n = 0;
+    const char* p = fmt;
+    while (*p && n < size - 1) {
+        if ('%' != *p) {
+            out[n++] = *p++;
+            continue;
+        }
+        if ('%' == p[1]) {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+        // 解析 %[flags][width][.precision][length]conversion，'*'替换为参数中的数值
+        char spec[64];
+        int k = 0;
+        spec[k++] = '%';
+        p++;
+        while (*p && strchr("-+ #0'", *p) && k < 40) {
+            spec[k++] = *p++;
+        }
+        arg_value v;
+        if ('*' == *p) {
+            int w = dec.next(v) ? (int)v.i : 0;
+            k += snprintf(spec + k, sizeof(spec) - k, "%d", w);
+            p++;
+        }
+        while (*p >= '0' && *p <= '9' && k < 48) {
+            spec[k++] = *p++;
+        }
+        int precision = -1;
+        if ('.' == *p) {
+            p++;
+            if ('*' == *p) {
+                precision = dec.next(v) ? (int)v.i : 0;
+                p++;
+            }
+            else {
+                precision = 0;
+                while (*p >= '0' && *p <= '9') {
+                    precision = precision * 10 + (*p++ - '0');
+                }
+            }
+        }
+        int length = 0;     // 1:h 2:hh 3:l及以上
+        while (*p && strchr("hlLqjzt", *p)) {
+            if ('h' == *p) {
+                length = (1 == length) ? 2 : 1;
+            }
+            else {
+                length = 3;
+            }
+            p++;
+        }
+        char conv = *p;
+        if (!conv) {
+            break;
+        }
+        p++;
+
+        bool have = dec.next(v);
+        int left = size - n;
+        int w = 0;
+        if ('s' == conv) {
+            if (!have || ARG_STR != v.type) {
+                w = snprintf(out + n, left, "(?)");
+            }
+            else {
+                int len = (precision >= 0 && precision < v.len) ? precision : v.len;
+                strcpy(spec + k, ".*s");
+                w = snprintf(out + n, left, spec, len, v.s);
+            }
+        }
+        else if (!have || ARG_STR == v.type) {
+            w = snprintf(out + n, left, "(?)");
+        }
+        else {
+            if (precision >= 0) {
+                k += snprintf(spec + k, sizeof(spec) - k, ".%d", precision);
+            }
+            if (strchr("di", conv)) {
+                long long x = v.i;
+                if (1 == length) {
+                    x = (short)x;
+                }
+                else if (2 == length) {
+                    x = (signed char)x;
+                }
+                else if (0 == length) {
+                    x = (int)x;
+                }
+                strcpy(spec + k, "lld");
+                w = snprintf(out + n, left, spec, x);
+            }
+            else if (strchr("uoxX", conv)) {
+                unsigned long long x = v.u;
+                if (1 == length) {
+                    x = (unsigned short)x;
+                }
+                else if (2 == length) {
+                    x = (unsigned char)x;
+                }
+                else if (0 == length) {
+                    x = (unsigned int)x;
+                }
+                spec[k] = 'l';
+                spec[k + 1] = 'l';
+                spec[k + 2] = conv;
+                spec[k + 3] = '\0';
+                w = snprintf(out + n, left, spec, x);
+            }
+            else if (strchr("eEfFgGaA", conv)) {
+                spec[k] = conv;
+                spec[k + 1] = '\0';
+                w = snprintf(out + n, left, spec, v.d);
+            }
+            else if ('c' == conv) {
+                strcpy(spec + k, "c");
+                w = snprintf(out + n, left, spec, (int)v.i);
+            }
+            else if ('p' == conv) {
+                strcpy(spec + k, "p");
+                w = snprintf(out + n, left, spec, (void*)(uintptr_t)v.u);
+            }
+            else {
+                w = snprintf(out + n, left, "(?)");
+            }
+        }
+        n += (w < left) ? w : left - 1;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// 格式化一整行日志，与文本日志的格式相同：时间、级别、内容和换行
+// record是encoder写出的记录，fmt是记录中的格式串指针对应的格式串，返回行的字节数
+inline int format_line(int level, const char* record, int len, const char* fmt, char* out, int size) {
+    static const char* levels[] = {"[debug]", "[info]:", "[warn]:", "[erro]:"};
+    const char* s = (level >= 0 && level <= 3) ? levels[level] : levels[1];
+    if (len < 16 || size < 64) {
+        return 0;
+    }
+    int64_t us;
+    memcpy(&us, record, 8);
+    time_t t = us / 1000000;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    int n = snprintf(out, size, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, (long)(us % 1000000), s);
+    n += format_args(fmt, record + 16, len - 16, out + n, size - n - 1);
+    out[n++] = '\n';
+    return n;
+}
+
+// 记录中的格式串指针
+inline uint64_t record_format(const char* record) {
+    uint64_t fmt;
+    memcpy(&fmt, record + 8, 8);
+    return fmt;
+}
+
+}
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef LOG_MMAP_H
+#define LOG_MMAP_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// 内存映射的环形日志文件，写日志的线程和离线的log_dump共用
+// 文件大小固定：开头一页是文件头，之后是capacity字节的数据区，按写入位置取模循环覆盖。
+// 写日志的线程用CAS在数据区占一段空间，把日志复制进映射的内存后提交，全程没有系统调用也不加锁；
+// 脏页由内核写回，进程崩溃时已写入的内容仍在页缓存中，重启后在原来的写入位置之后继续写
+//
+// 数据区中每条记录是[16字节记录头][日志内容]，按8字节对齐。记录头中的seq是记录的绝对写入位置（不取模）加一，
+// 写入内容前先把seq清零，写完后以release语义写入seq提交；读的一方只承认seq与位置相符的记录，
+// 由此识别出还没写完、写到一半进程崩溃或已经被后来的记录覆盖的部分。
+// 记录不跨越数据区末尾，放不下时用填充记录补齐，剩余空间连记录头都放不下时直接跳到下一圈开头。
+// 不同圈的写入之间没有同步：一个线程在提交前停顿了整整一圈时，它的记录可能与新记录互相覆盖，这样的记录会损坏
+static const char LOG_MMAP_MAGIC[8] = {'W', 'S', 'M', 'L', 'O', 'G', '1', '\n'};
+
+class log_mmap {
+public:
+    // 文件头，占文件的第一页
+    struct file_header {
+        char magic[8];
+        uint32_t header_size;   // 文件头大小，数据区从这里开始
+        uint32_t reserved;
+        uint64_t capacity;      // 数据区大小
+        uint64_t write_pos;     // 下一条记录的绝对写入位置，只用原子操作访问
+    };
+
+    // 记录头
+    struct entry {
+        uint64_t seq;           // 记录的绝对写入位置加一，0表示未提交
+        uint32_t len;           // 日志内容的字节数
+        uint16_t level;         // 日志级别
+        uint16_t type;          // ENTRY_DATA或ENTRY_PAD
+    };
+
+    enum entry_type {
+        ENTRY_DATA = 1,         // 一行日志
+        ENTRY_PAD               // 数据区末尾放不下下一条记录时的填充
+    };
+
+    static const uint32_t HEADER_SIZE = 4096;
+    // 数据区最小值，保证最长的一行日志也放得下
+    static const uint64_t MIN_CAPACITY = 1 << 20;
+
+    log_mmap() : m_base(nullptr), m_size(0), m_header(nullptr), m_data(nullptr), m_capacity(0) {}
+
+    ~log_mmap() {
+        if (m_base) {
+            munmap(m_base, m_size);
+        }
+    }
+
+    // 写日志的一方打开或创建环形文件，capacity向上取整到页大小
+    // 已有的文件头有效且大小相同时沿用其中的内容和写入位置，否则重新初始化
+    bool open_write(const char* path, uint64_t capacity) {
+        if (capacity < MIN_CAPACITY) {
+            capacity = MIN_CAPACITY;
+        }
+        capacity = (capacity + HEADER_SIZE - 1) / HEADER_SIZE * HEADER_SIZE;
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        size_t size = HEADER_SIZE + capacity;
+        struct stat st;
+        bool reuse = 0 == fstat(fd, &st) && (size_t)st.st_size == size;
+        // 大小不同时先截断为0再预先分配，数据区全部为0即没有已提交的记录；
+        // 不能用稀疏文件，否则磁盘满时写映射的内存会收到SIGBUS
+        if (!reuse && (ftruncate(fd, 0) < 0 || 0 != posix_fallocate(fd, 0, size))) {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == p) {
+            return false;
+        }
+        m_base = (char*)p;
+        m_size = size;
+        m_header = (file_header*)m_base;
+        m_data = m_base + HEADER_SIZE;
+        m_capacity = capacity;
+        if (!reuse || !valid_header()) {
+            memset(m_header, 0, sizeof(file_header));
+            m_header->header_size = HEADER_SIZE;
+            m_header->capacity = capacity;
+            if (reuse) {
+                memset(m_data, 0, capacity);
+            }
+            __atomic_store_n(&m_header->write_pos, 0, __ATOMIC_RELAXED);
+            memcpy(m_header->magic, LOG_MMAP_MAGIC, sizeof(LOG_MMAP_MAGIC));
+        }
+        return true;
+    }
+
+    // 读的一方以只读方式映射环形文件，可以在写日志的进程运行中或退出后读取
+    bool open_read(const char* path) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < HEADER_SIZE + MIN_CAPACITY) {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == p) {
+            return false;
+        }
+        m_base = (char*)p;
+        m_size = st.st_size;
+        m_header = (file_header*)m_base;
+        m_data = m_base + HEADER_SIZE;
+        m_capacity = m_header->capacity;
+        return valid_header() && HEADER_SIZE + m_capacity == m_size;
+    }
+
+    // 写入一行日志，len超过数据区大小的部分被截断
+    void append(int level, const char* data, uint32_t len) {
+        if (len > m_capacity / 2) {
+            len = m_capacity / 2;
+        }
+        uint64_t need = align(sizeof(entry) + len);
+        uint64_t pos = __atomic_load_n(&m_header->write_pos, __ATOMIC_RELAXED);
+        uint64_t room;
+        do {
+            room = m_capacity - pos % m_capacity;
+        } while (!__atomic_compare_exchange_n(&m_header->write_pos, &pos, pos + (need <= room ? need : room + need),
+                                              true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        if (need > room) {
+            // 本圈剩余的空间放不下，用填充记录补齐后从下一圈开头写
+            if (room >= sizeof(entry)) {
+                commit(pos, ENTRY_PAD, 0, nullptr, room - sizeof(entry));
+            }
+            pos += room;
+        }
+        commit(pos, ENTRY_DATA, level, data, len);
+    }
+
+    // 下一条记录的绝对写入位置，读的一方以它为终点
+    uint64_t write_pos() const {
+        return __atomic_load_n(&m_header->write_pos, __ATOMIC_ACQUIRE);
+    }
+
+    uint64_t capacity() const {
+        return m_capacity;
+    }
+
+    /**
+     * 读取绝对位置pos处的记录
+     * @return 该位置有已提交的记录时返回true，next为下一条记录的位置，
+     *         日志内容复制到out（最多size字节），len为复制的字节数，填充记录的len为0、level为-1；
+     *         没有写完、已被覆盖或pos不在记录开头时返回false，读的一方每次前进8字节重新寻找记录头
+     */
+    bool read(uint64_t pos, char* out, uint32_t size, uint32_t& len, int& level, uint64_t& next) const {
+        uint64_t room = m_capacity - pos % m_capacity;
+        if (room < sizeof(entry)) {
+            len = 0;
+            level = -1;
+            next = pos + room;
+            return true;
+        }
+        const entry* e = (const entry*)(m_data + pos % m_capacity);
+        if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+            return false;
+        }
+        uint32_t n = e->len;
+        uint16_t type = e->type;
+        int lv = e->level;
+        if (sizeof(entry) + n > room || (ENTRY_DATA != type && ENTRY_PAD != type)) {
+            return false;
+        }
+        uint32_t copy = (ENTRY_DATA == type) ? (n < size ? n : size) : 0;
+        memcpy(out, e + 1, copy);
+        // 与提交时的顺序相反：先读内容再检查seq，复制期间被覆盖时seq已经改变
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != pos + 1) {
+            return false;
+        }
+        len = copy;
+        level = (ENTRY_DATA == type) ? lv : -1;
+        next = pos + align(sizeof(entry) + n);
+        return true;
+    }
+
+private:
+    static uint64_t align(uint64_t n) {
+        return (n + 7) & ~(uint64_t)7;
+    }
+
+    bool valid_header() const {
+        return 0 == memcmp(m_header->magic, LOG_MMAP_MAGIC, sizeof(LOG_MMAP_MAGIC)) &&
+               HEADER_SIZE == m_header->header_size && m_capacity == m_header->capacity &&
+               m_capacity >= MIN_CAPACITY && 0 == m_capacity % 8;
+    }
+
+    // 先把seq清零使旧记录失效，写入记录头和内容后再提交seq
+    void commit(uint64_t pos, int type, int level, const char* data, uint32_t len) {
+        entry* e = (entry*)(m_data + pos % m_capacity);
+        __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        e->len = len;
+        e->level = level;
+        e->type = type;
+        if (data) {
+            memcpy(e + 1, data, len);
+        }
+        __atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+
+    char* m_base;               // 映射的起始地址
+    size_t m_size;              // 映射的大小
+    file_header* m_header;
+    char* m_data;               // 数据区
+    uint64_t m_capacity;
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include "../lock/locker.h"
+
+// 异步日志使用的有界无锁多生产者单消费者环形缓冲区
+// 槽位是固定大小的日志记录，构造时一次性分配；生产者用CAS占下一个槽位后直接把日志格式化进去，
+// 不分配内存也不复制string。唤醒是批量的：积压的记录达到wake_batch条或有ERROR日志时才唤醒消费者，
+// 其余情况由消费者按超时自己醒来，所以忙碌时每条日志都不会进入内核
+class log_ring {
+public:
+    // 缓冲区满时的处理方式
+    enum full_policy {
+        FULL_BLOCK = 0,   // 生产者等待消费者腾出槽位
+        FULL_DROP         // 丢弃这条日志并计数
+    };
+
+    // 一条日志记录，data的实际长度为构造时的record_size
+    struct record {
+        std::atomic<size_t> sequence;   // 与mpmc_queue相同的槽位序号
+        int level;                      // 日志级别
+        int len;                        // data中日志的长度
+        char data[1];
+    };
+
+    // capacity: 最少的记录条数，向上取整到2的幂；record_size: 每条记录最多容纳的字节数
+    log_ring(size_t capacity, int record_size, int policy, size_t wake_batch = 64)
+        : m_policy(policy), m_wake_batch(wake_batch), m_dropped(0) {
+        if (0 == capacity || record_size <= 0) {
+            throw std::exception();
+        }
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_record_size = record_size;
+        // 每条记录按缓存行对齐，避免相邻记录的生产者互相干扰
+        m_stride = (offsetof(record, data) + record_size + 63) & ~(size_t)63;
+        m_records = new char[m_stride * size + 64];
+        m_base = (char*)(((uintptr_t)m_records + 63) & ~(uintptr_t)63);
+        for (size_t i = 0; i < size; i++) {
+            new (&at(i)->sequence) std::atomic<size_t>(i);
+        }
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+        m_closed.store(false, std::memory_order_relaxed);
+    }
+
+    ~log_ring() {
+        delete[] m_records;
+    }
+
+    // 生产者占下一个槽位，之后把日志写入data并调用publish
+    // 缓冲区满时按策略等待或返回nullptr（丢弃计数加一）
+    record* claim() {
+        while (true) {
+            record* r = try_claim();
+            if (r) {
+                return r;
+            }
+            if (FULL_DROP == m_policy) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            // 先确保消费者醒着，再等它腾出槽位
+            m_data_event.notify_one();
+            unsigned int key = m_space_event.prepare_wait();
+            r = try_claim();
+            if (r) {
+                m_space_event.cancel_wait();
+                return r;
+            }
+            m_space_event.wait(key);
+        }
+    }
+
+    // 生产者写好level、len和data后发布，积压达到批量或ERROR日志时唤醒消费者
+    void publish(record* r) {
+        // 占下槽位后序号仍等于该槽位的位置，发布前不会被其他线程修改
+        // 发布后槽位可能立即被消费者取走并被其他生产者重用，级别要在发布前读出
+        size_t pos = r->sequence.load(std::memory_order_relaxed);
+        bool urgent = (3 == r->level);
+        r->sequence.store(pos + 1, std::memory_order_release);
+        if (urgent || size() >= m_wake_batch) {
+            m_data_event.notify_one();
+        }
+    }
+
+    // 下一条记录是否已发布，只查看不取出；关闭后总是返回false，消费者按超时等待
+    bool peek() const {
+        if (m_closed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        return at(pos & m_mask)->sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // 消费者取出下一条已发布的记录，没有记录或缓冲区已关闭时返回nullptr；写出后必须调用release
+    // 取出时用CAS推进读位置，崩溃处理同时取记录时每条记录只会被其中一方取到
+    record* take() {
+        if (m_closed.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return take_next();
+    }
+
+    // 消费者归还take取出的记录，槽位可以被生产者重用
+    void release(record* r) {
+        size_t seq = r->sequence.load(std::memory_order_relaxed);
+        r->sequence.store(seq + m_mask, std::memory_order_release);
+    }
+
+    // 崩溃时关闭缓冲区，此后消费者的take不再取到记录，剩余已发布的记录由崩溃处理用take_closed取出
+    // 消费者关闭前已取出、还没写完的记录不会再被取到。只用原子操作，可以在信号处理函数中调用
+    void close() {
+        m_closed.store(true, std::memory_order_seq_cst);
+    }
+
+    // 关闭后取出下一条已发布的记录，不归还槽位
+    record* take_closed() {
+        return take_next();
+    }
+
+    // 消费者处理完一批记录后唤醒等待槽位的生产者，没有等待者时只是一次内存读
+    void notify_space() {
+        m_space_event.notify_all();
+    }
+
+    // 消费者在缓冲区为空时等待，有新记录被唤醒返回true，超时返回false
+    bool wait(int ms_timeout) {
+        unsigned int key = m_data_event.prepare_wait();
+        if (peek()) {
+            m_data_event.cancel_wait();
+            return true;
+        }
+        return m_data_event.wait(key, ms_timeout);
+    }
+
+    // 唤醒消费者，用于退出或需要立即写出时
+    void wake() {
+        m_data_event.notify_one();
+    }
+
+    // 缓冲区中记录数的近似值
+    size_t size() const {
+        size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    int record_size() const {
+        return m_record_size;
+    }
+
+    // 因缓冲区满被丢弃的日志条数
+    long long dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    record* at(size_t index) const {
+        return (record*)(m_base + index * m_stride);
+    }
+
+    // 读位置上的记录已发布时用CAS取出，没有时返回nullptr
+    record* take_next() {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            record* r = at(pos & m_mask);
+            if (r->sequence.load(std::memory_order_acquire) != pos + 1) {
+                return nullptr;
+            }
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return r;
+            }
+        }
+    }
+
+    // 与mpmc_queue::push相同的抢占方式，缓冲区满时返回nullptr
+    record* try_claim() {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            record* r = at(pos & m_mask);
+            size_t seq = r->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (0 == diff) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return r;
+                }
+            }
+            else if (diff < 0) {
+                return nullptr;
+            }
+            else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    char* m_records;             // 分配的内存
+    char* m_base;                // 按缓存行对齐后的第一条记录
+    size_t m_stride;             // 相邻记录的间隔
+    size_t m_mask;
+    int m_record_size;
+    int m_policy;
+    size_t m_wake_batch;
+    eventcount m_data_event;     // 消费者在上面等待新记录
+    eventcount m_space_event;    // 阻塞策略下生产者在上面等待空闲槽位
+    std::atomic<long long> m_dropped;
+    char m_pad0[64];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad1[64];
+    std::atomic<size_t> m_dequeue_pos;   // 消费者（崩溃时还有崩溃处理）用CAS推进，生产者只读来估计积压
+    std::atomic<bool> m_closed;          // 崩溃处理已关闭缓冲区
+    char m_pad2[64];
+};
+
+#endif
@@ -12,7 +12,8 @@ int main(int argc, char* argv[]) {
     WebServer server;
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, config.OPT_LINGER, 
-        config.TRIGMode, config.sql_num, config.thread_num, config.close_log, config.actor_model);
+        config.TRIGMode, config.sql_num, config.max_sql_num, config.user_cache, config.thread_num, config.close_log, config.actor_model, config.sched_mode, config.batch_size, config.max_thread_num, config.codel_target, config.cpu_list, config.log_full, config.log_level,
+        config.log_max_mb, config.log_ring_mb, config.log_keep, config.log_compress);
     //日志
     server.log_write();
     //数据库
@@ -0,0 +1,120 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <vector>
+#include <string>
+
+// 绑核与NUMA相关的工具函数，只依赖pthread、sysfs和系统调用，不需要链接libnuma
+// 内存按first-touch策略分配在第一次写入它的线程所在的节点，所以只要先绑核再分配并写入每一页（touch_pages），内存就在本地节点
+
+// 解析"0-3,8,10-11"形式的CPU列表，格式错误时返回空列表
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return std::vector<int>();
+        }
+        long last = first;
+        p = end;
+        if ('-' == *p) {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) {
+                return std::vector<int>();
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back((int)cpu);
+        }
+        if (',' == *p) {
+            p++;
+        }
+        else if (*p) {
+            return std::vector<int>();
+        }
+    }
+    return cpus;
+}
+
+// CPU所属的NUMA节点，从/sys/devices/system/cpu/cpuN/nodeX读取，无法判断时返回-1
+inline int cpu_to_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (0 == strncmp(entry->d_name, "node", 4) && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+// 由当前线程写入[addr, addr + len)的每一页，使页面按first-touch分配在当前线程所在的节点。
+// 写回读到的值，不改变内容，可以用于已经构造好的对象；调用时不能有其他线程在访问这段内存
+inline void touch_pages(void* addr, size_t len) {
+    long page = sysconf(_SC_PAGESIZE);
+    volatile char* p = (volatile char*)addr;
+    for (size_t off = 0; off < len; off += page) {
+        p[off] = p[off];
+    }
+    if (len) {
+        p[len - 1] = p[len - 1];
+    }
+}
+
+// 页面当前所在的NUMA节点，用move_pages只查询不移动，页面还未分配或无法判断时返回-1
+inline int page_node(void* addr) {
+#ifdef SYS_move_pages
+    void* page = (void*)((unsigned long)addr & ~((unsigned long)sysconf(_SC_PAGESIZE) - 1));
+    int status = -1;
+    if (0 == syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) && status >= 0) {
+        return status;
+    }
+#endif
+    return -1;
+}
+
+// 把线程绑定到一个CPU上
+inline bool pin_thread(pthread_t tid, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return 0 == pthread_setaffinity_np(tid, sizeof(set), &set);
+}
+
+// 把当前线程绑定到一个CPU上
+inline bool pin_current_thread(int cpu) {
+    return pin_thread(pthread_self(), cpu);
+}
+
+// 把CPU列表格式化为"0,1,2"，用于启动时输出绑核情况
+inline std::string format_cpu_list(const std::vector<int>& cpus) {
+    std::string s;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        if (i) {
+            s += ',';
+        }
+        s += std::to_string(cpus[i]);
+    }
+    return s;
+}
+
+#endif
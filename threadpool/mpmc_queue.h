@@ -0,0 +1,194 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+
+// 有界无锁多生产者多消费者环形队列（Dmitry Vyukov的bounded MPMC queue）
+// 构造时一次性分配全部槽位，入队出队都只是对槽位序号和队首/队尾位置做CAS，
+// 不加锁也不分配内存。容量向上取整到2的幂，以便用掩码代替取模
+template <typename T>
+class mpmc_queue {
+public:
+    // capacity: 最少需要容纳的元素个数
+    mpmc_queue(size_t capacity) {
+        if (0 == capacity) {
+            throw std::exception();
+        }
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells = new cell[size];
+        for (size_t i = 0; i < size; i++) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_queue() {
+        delete[] m_cells;
+    }
+
+    // 入队，队列已满返回false
+    bool push(const T& item) {
+        T copy(item);
+        return push(std::move(copy));
+    }
+
+    // 移动入队，用于只能移动的元素，队列已满返回false且item保持不变
+    bool push(T&& item) {
+        cell* c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (0 == diff) {
+                // 槽位空闲，抢占这个位置
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                // 槽位还没被消费者取走，队列已满
+                return false;
+            }
+            else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = std::move(item);
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 出队，队列为空返回false
+    bool pop(T& item) {
+        cell* c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (0 == diff) {
+                // 槽位已写好数据，抢占这个位置
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                // 槽位还没有数据，队列为空
+                return false;
+            }
+            else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(c->data);
+        c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 批量入队，一次CAS占下从当前队尾开始连续的空闲槽位
+    // 返回实际放入的个数（items的前若干个），队列已满时返回0
+    size_t push_batch(const T* items, size_t n) {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t k;
+        while (true) {
+            // 数一数从pos开始有几个连续的空闲槽位，空闲槽位只能被抢到对应位置的生产者改变，
+            // 所以只要下面的CAS成功，这些槽位就都归本线程所有
+            for (k = 0; k < n; k++) {
+                size_t seq = m_cells[(pos + k) & m_mask].sequence.load(std::memory_order_acquire);
+                if (seq != pos + k) {
+                    break;
+                }
+            }
+            if (0 == k) {
+                size_t seq = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+                if ((intptr_t)seq - (intptr_t)pos < 0) {
+                    return 0;
+                }
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < k; i++) {
+            cell* c = &m_cells[(pos + i) & m_mask];
+            c->data = items[i];
+            c->sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return k;
+    }
+
+    // 批量出队，一次CAS取走从当前队首开始连续的已就绪元素，最多max个
+    // 返回实际取出的个数，队列为空时返回0
+    size_t pop_batch(T* items, size_t max) {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        size_t k;
+        while (true) {
+            for (k = 0; k < max; k++) {
+                size_t seq = m_cells[(pos + k) & m_mask].sequence.load(std::memory_order_acquire);
+                if (seq != pos + k + 1) {
+                    break;
+                }
+            }
+            if (0 == k) {
+                size_t seq = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+                if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) {
+                    return 0;
+                }
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < k; i++) {
+            cell* c = &m_cells[(pos + i) & m_mask];
+            items[i] = c->data;
+            c->sequence.store(pos + i + m_mask + 1, std::memory_order_release);
+        }
+        return k;
+    }
+
+    // 队列中元素个数的近似值，并发修改时只作参考
+    size_t size() const {
+        size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    // 实际容量
+    size_t capacity() const {
+        return m_mask + 1;
+    }
+
+private:
+    // 每个槽位带一个序号，表示它当前可以被哪个位置的生产者或消费者使用
+    struct cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    // 队首和队尾位置分别独占缓存行，避免生产者和消费者之间的伪共享
+    char m_pad0[64];
+    cell* m_cells;
+    size_t m_mask;
+    char m_pad1[64];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad2[64];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_pad3[64];
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef THREADPOOL_TASK_H
+#define THREADPOOL_TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 线程池中的通用任务：可以保存任意无参可调用对象，只能移动不能复制
+// 与std::function不同，它能保存std::packaged_task这类只能移动的对象；
+// 捕获不超过INLINE_SIZE字节的可调用对象直接放在对象内部，不分配堆内存，更大的才放到堆上
+class threadpool_task {
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    threadpool_task() : m_ops(nullptr) {}
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, threadpool_task>::value>::type>
+    threadpool_task(F&& f) {
+        typedef typename std::decay<F>::type func_type;
+        if (sizeof(func_type) <= INLINE_SIZE && alignof(func_type) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<func_type>::value) {
+            new (m_storage) func_type(std::forward<F>(f));
+            m_ops = &inline_ops<func_type>::table;
+        }
+        else {
+            *(func_type**)m_storage = new func_type(std::forward<F>(f));
+            m_ops = &heap_ops<func_type>::table;
+        }
+    }
+
+    threadpool_task(threadpool_task&& other) : m_ops(other.m_ops) {
+        if (m_ops) {
+            m_ops->move(m_storage, other.m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+
+    threadpool_task& operator=(threadpool_task&& other) {
+        if (this != &other) {
+            reset();
+            m_ops = other.m_ops;
+            if (m_ops) {
+                m_ops->move(m_storage, other.m_storage);
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    threadpool_task(const threadpool_task&) = delete;
+    threadpool_task& operator=(const threadpool_task&) = delete;
+
+    ~threadpool_task() {
+        reset();
+    }
+
+    // 执行任务，执行后任务仍然保存着可调用对象，需要释放时调用reset
+    void operator()() {
+        m_ops->invoke(m_storage);
+    }
+
+    // 释放保存的可调用对象，未执行就释放相当于取消任务
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    explicit operator bool() const {
+        return m_ops != nullptr;
+    }
+
+private:
+    // 每种可调用对象类型一张操作表，代替虚函数
+    struct ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    // 可调用对象保存在m_storage内部
+    template <typename F>
+    struct inline_ops {
+        static void invoke(void* storage) {
+            (*(F*)storage)();
+        }
+        static void move(void* dst, void* src) {
+            new (dst) F(std::move(*(F*)src));
+            ((F*)src)->~F();
+        }
+        static void destroy(void* storage) {
+            ((F*)storage)->~F();
+        }
+        static const ops table;
+    };
+
+    // 可调用对象在堆上，m_storage中只保存指针
+    template <typename F>
+    struct heap_ops {
+        static void invoke(void* storage) {
+            (**(F**)storage)();
+        }
+        static void move(void* dst, void* src) {
+            *(F**)dst = *(F**)src;
+        }
+        static void destroy(void* storage) {
+            delete *(F**)storage;
+        }
+        static const ops table;
+    };
+
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    const ops* m_ops;
+};
+
+template <typename F>
+const threadpool_task::ops threadpool_task::inline_ops<F>::table = {
+    &threadpool_task::inline_ops<F>::invoke,
+    &threadpool_task::inline_ops<F>::move,
+    &threadpool_task::inline_ops<F>::destroy
+};
+
+template <typename F>
+const threadpool_task::ops threadpool_task::heap_ops<F>::table = {
+    &threadpool_task::heap_ops<F>::invoke,
+    &threadpool_task::heap_ops<F>::move,
+    &threadpool_task::heap_ops<F>::destroy
+};
+
+#endif
@@ -1,185 +1,982 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
-#include <list>
 #include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <new>
+#include <future>
+#include <stdexcept>
+#include <atomic>
+#include <time.h>
+#include <math.h>
 #include "../lock/locker.h"
 #include "../log/log.h"
+#include "../CGImysql/sql_connection_pool.h"
+#include "mpmc_queue.h"
+#include "work_steal_queue.h"
+#include "task.h"
+#include "affinity.h"
+
+// 线程池运行统计，用于观察入队、出队、唤醒的开销以及弹性伸缩的效果
+struct threadpool_stats {
+    long long enqueue_calls; // 入队操作次数，批量入队只算一次
+    long long enqueued;      // 入队的任务数
+    long long dequeue_calls; // 工作线程取任务的次数，批量取只算一次
+    long long dequeued;      // 工作线程取到的任务数
+    long long sleeps;        // 工作线程因队列为空而睡眠的次数
+    long long wake_calls;    // 进入内核唤醒工作线程的次数
+    int threads;             // 当前线程数
+    int min_threads;         // 线程数下限
+    int max_threads;         // 线程数上限
+    long long grows;         // 因排队时间过长而增加线程的次数
+    long long shrinks;       // 因空闲而回收线程的次数
+    long long queue_depth;   // 当前排队的任务数
+    long long wait_total_us; // 所有任务累计排队时间（微秒）
+    long long wait_max_us;   // 上次获取统计以来单个任务的最长排队时间（微秒）
+    long long shed;          // 因排队时间持续超标被丢弃、直接返回503的任务数
+    long long tasks;         // 执行完的通用任务数
+};
 
 // 模板类threadpool用于创建和管理线程池
 // T是任务的类型，即线程池将要处理的任务的数据类型
+// 线程数在[thread_number, max_thread_number]之间弹性变化：
+// 任务排队时间超过GROW_WAIT_US时增加线程，线程空闲超过IDLE_TIMEOUT_MS后退出，退出的线程会被join回收
+// 除了T类型的请求，还可以通过submit/async提交任意可调用对象（缓存刷新、日志压缩等），两者共用同一组线程
 template <typename T>
 class threadpool {
 public:
     // 构造函数，初始化线程池
     // actor_model: 表示行动模型的整数，用于区分不同的处理策略
     // connPool: 数据库连接池的指针，提供数据库连接服务
-    // thread_number: 线程池中线程的数量，默认为8
+    // thread_number: 线程池中线程的数量，默认为8，弹性伸缩时为线程数下限
     // max_request: 请求队列中最多允许的，等待处理的请求数量，默认为10000
-    threadpool(int actor_model, connection_pool* connPool, int thread_number = 8, int max_request = 10000);
+    // sched_mode: 调度模式，0为所有线程共享一个任务队列，1为每线程一个队列并相互窃取任务
+    // batch_size: 工作线程每次被唤醒后最多连续取出的任务数，默认为1
+    // max_thread_number: 线程数上限，不大于thread_number时线程数固定不变
+    threadpool(int actor_model, connection_pool* connPool, int thread_number = 8, int max_request = 10000, int sched_mode = 0, int batch_size = 1, int max_thread_number = 0);
 
-    // 析构函数，销毁线程池
+    // 析构函数，销毁线程池，未执行的请求和任务被取消，等所有线程退出后才返回
     ~threadpool();
 
+    // 关闭线程池并join所有线程，之后不再接受新的请求和任务
+    // drain为true时先处理完队列中已有的请求和任务；为false时线程处理完手上的任务即退出，
+    // 队列中的请求被放弃，任务被直接释放（async返回的future得到broken_promise异常）
+    void shutdown(bool drain = true);
+
+    // 提交一个通用任务，f为无参可调用对象，可以只能移动，异常不能抛出到线程池
+    // 需要结果或回调时可以在f里完成，或者使用async
+    // 返回值: 任务队列已满或线程池已关闭时返回false，f被丢弃
+    template <typename F>
+    bool submit(F&& f) {
+        if (m_stop.load(std::memory_order_acquire)) {
+            return false;
+        }
+        threadpool_task task(std::forward<F>(f));
+        if (!m_taskqueue.push(std::move(task))) {
+            return false;
+        }
+        m_queue_event.notify_one();
+        return true;
+    }
+
+    // 提交一个通用任务并通过future取得返回值或异常
+    // 任务队列已满或线程池已关闭时future中保存std::runtime_error
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> async(F&& f) {
+        typedef typename std::result_of<F()>::type result_type;
+        std::packaged_task<result_type()> job(std::forward<F>(f));
+        std::future<result_type> result = job.get_future();
+        if (!submit(std::move(job))) {
+            std::packaged_task<result_type()> rejected([]() -> result_type {
+                throw std::runtime_error("threadpool rejected the task");
+            });
+            result = rejected.get_future();
+            rejected();
+        }
+        return result;
+    }
+
     // 向线程池添加一个任务请求
     // request: 要添加的任务请求
     // state: 任务的状态或标记
-    // 返回值: 添加任务是否成功
+    // 返回值: 添加任务是否成功，队列已满时返回false，被拒绝的请求由调用者负责处理
     bool append(T* request, int state);
 
     // 向线程池添加一个任务请求，用于处理具有不同优先级或属性的任务
     // request: 要添加的任务请求
-    // 返回值: 添加任务是否成功
+    // 返回值: 添加任务是否成功，队列已满时返回false，被拒绝的请求由调用者负责处理
     bool append_p(T* request);
 
+    // 一次性添加一批任务请求，整批只做一次入队操作和一次唤醒
+    // requests: 任务请求数组
+    // states: 每个请求的状态，与append的state含义相同；为nullptr时与append_p相同，不修改状态
+    // n: 请求个数
+    // 返回值: 成功添加的个数，总是requests的前若干个，其余请求因队列已满被拒绝，由调用者负责处理
+    int append_batch(T** requests, const int* states, int n);
+
+    // 获取运行统计，同时清零各线程记录的最长排队时间
+    void get_stats(threadpool_stats& stats);
+
+    // 设置数据库通道，之后本线程池只处理不访问数据库的请求
+    // 需要数据库的请求（T::is_db_request()为真）转交给db_lane处理，db_lane的线程数一般与数据库连接数相同，
+    // 这样数据库变慢时只会堵住db_lane，静态文件请求不会因为等待数据库连接而排队
+    void set_db_lane(threadpool* db_lane) {
+        m_db_lane = db_lane;
+    }
+
+    // 设置工作线程绑定的CPU，第i个线程槽位绑定到cpus[i % cpus.size()]
+    // 已经在运行的线程立即迁移，之后弹性扩容创建的线程在创建时就绑定好；cpus为空时不绑核
+    // 返回值: 所有已运行线程都绑定成功时返回true
+    bool set_affinity(const std::vector<int>& cpus) {
+        bool ok = true;
+        m_grow_lock.lock();
+        m_cpus = cpus;
+        for (int i = 0; i < m_max_thread_number && !m_cpus.empty(); i++) {
+            if (WORKER_RUNNING == m_worker_args[i].state.load(std::memory_order_acquire) &&
+                !pin_thread(m_threads[i], m_cpus[i % m_cpus.size()])) {
+                ok = false;
+            }
+        }
+        m_grow_lock.unlock();
+        return ok;
+    }
+
+    // 开启按排队时间的过载保护（CoDel）
+    // 任务排队时间持续一个interval_ms都高于target_ms时开始丢弃新请求，被丢弃的请求由T::reply_busy()直接回复503；
+    // 丢弃间隔按interval/sqrt(丢弃次数)逐渐缩短，排队时间回到目标以下即停止丢弃。target_ms为0时关闭
+    void set_codel(int target_ms, int interval_ms = 100) {
+        m_codel_target_us = target_ms * 1000LL;
+        m_codel_interval_us = interval_ms * 1000LL;
+    }
+
+    // 线程数固定且与连接池中的连接数相同时，让每个工作线程独占一个连接：
+    // 第一次处理请求时从连接池取出，线程退出时才归还，处理请求时不再经过连接池的锁和信号量，
+    // 连接断开由持有它的线程在下一个请求前原处重连。线程数可变或与连接数不同时仍按请求从连接池取连接
+    // 需在开始接收请求前调用，返回值: 是否启用了独占连接
+    bool set_thread_conns() {
+        m_own_conns = m_connPool && m_max_thread_number == m_thread_number &&
+                      m_connPool->GetFreeConn() == m_thread_number;
+        return m_own_conns;
+    }
+
 private:
+    // 排队时间超过该值（微秒）且未达到上限时增加一个线程
+    static const long long GROW_WAIT_US = 20000;
+    // 两次增加线程之间的最小间隔（微秒），避免一次积压就瞬间扩到上限
+    static const long long GROW_INTERVAL_US = 10000;
+    // 线程连续空闲超过该值（毫秒）且线程数高于下限时退出
+    static const int IDLE_TIMEOUT_MS = 30000;
+    // 通用任务队列的容量
+    static const int TASK_QUEUE_SIZE = 1024;
+
+    // 关闭状态
+    enum STOP_MODE {
+        STOP_NONE = 0,   // 正常运行
+        STOP_DRAIN,      // 处理完队列中的任务后退出
+        STOP_CANCEL      // 放弃队列中的任务立即退出
+    };
+
+    // 队列中的一项：任务请求和入队时间
+    struct task_item {
+        T* request;
+        long long enqueue_us;
+    };
+
+    // 每个线程槽位的状态
+    enum WORKER_STATE {
+        WORKER_FREE = 0,  // 未使用
+        WORKER_RUNNING,   // 线程正在运行
+        WORKER_EXITED     // 线程已退出，等待join
+    };
+
+    // 传给每个工作线程的参数，记录所属线程池、线程编号和槽位状态
+    // 出队相关的统计只由所属线程写入，按缓存行对齐避免线程之间伪共享
+    struct alignas(64) worker_arg {
+        threadpool* pool;
+        int index;
+        std::atomic<int> state;
+        std::atomic<long long> dequeue_calls;
+        std::atomic<long long> dequeued;
+        std::atomic<long long> sleeps;
+        std::atomic<long long> wait_total_us;
+        std::atomic<long long> wait_max_us;
+        std::atomic<long long> tasks;
+    };
+
     // 线程工作函数，每个线程都会执行这个函数以从队列中获取任务并处理
     static void* worker(void *arg);
 
-    // 运行线程池中的任务
-    void run();
+    // 运行线程池中的任务，线程因空闲被回收时返回
+    void run(int index);
+
+    // 把任务放入队列，两种调度模式共用
+    bool enqueue(T* request);
+
+    // 工作窃取模式下为外部线程投递的任务选择一个正在运行的线程的队列
+    int pick_queue();
+
+    // 取最多max个任务放入items，返回取到的个数，没有任务时返回0
+    // 工作窃取模式下先取自己的队列，再随机挑选其他线程的队列窃取
+    int dequeue(int index, unsigned int& seed, task_item* items, int max);
+
+    // 执行一个通用任务
+    void run_task(worker_arg& self, threadpool_task& task);
+
+    // 按actor模型处理一个任务，shed为true时不处理请求，直接回复503
+    void process_request(T* request, bool shed);
+
+    // CoDel判定：根据任务的排队时间和队列中剩余的任务数决定是否丢弃该任务
+    bool codel_should_drop(long long sojourn_us, size_t remaining, long long now);
+
+    // 解析请求并生成响应，只有需要时才从连接池取数据库连接
+    void process_parsed(T* request);
+
+    // 用本线程独占的连接处理请求
+    void process_owned(T* request);
+
+    // 排队时间达到阈值时增加一个线程
+    void maybe_grow(long long wait_us, long long now);
+
+    // 在空闲槽位上创建一个工作线程，调用者需持有m_grow_lock
+    bool spawn_worker();
+
+    // 空闲超时后尝试退出当前线程，线程数已到下限时返回false
+    bool try_retire(int index);
+
+    // 当前单调时钟时间（微秒）
+    static long long now_us() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+
+    // 单写者计数器加n，不需要原子读改写指令
+    static void add_counter(std::atomic<long long>& counter, long long n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
 
 private:
-    int m_thread_number;         // 线程池中的线程数量
+    int m_thread_number;         // 线程池中的线程数量下限
+    int m_max_thread_number;     // 线程池中的线程数量上限
     int m_max_requests;          // 请求队列中最多允许的，等待处理的请求数量
-    pthread_t* m_threads;        // 线程池中所有线程的句柄数组
-    std::list<T* > m_workqueue;  // 任务队列，存储等待处理的任务指针
-    locker m_queuelocker;        // 队列的锁，用于线程安全
-    sem m_queuestat;             // 队列状态信号量，用于同步和互斥
+    pthread_t* m_threads;        // 线程池中所有线程槽位的句柄数组，长度为上限
+    mpmc_queue<task_item> m_workqueue;  // 任务队列，预分配的无锁环形队列
+    mpmc_queue<threadpool_task> m_taskqueue; // 通用任务队列
+    eventcount m_queue_event;    // 队列事件，空闲线程在上面睡眠，有新请求或任务时唤醒
+    std::atomic<int> m_stop;     // 关闭状态，见STOP_MODE
     connection_pool *m_connPool; // 数据库连接池的指针
     int m_actor_model;           // 模型切换
+    int m_sched_mode;            // 调度模式，0共享队列，1工作窃取
+    int m_batch_size;            // 工作线程每次最多连续取出的任务数
+    std::atomic<long long> m_enqueue_calls; // 入队操作次数
+    std::atomic<long long> m_enqueued;      // 入队任务数
+    std::atomic<int> m_cur_threads;         // 当前线程数
+    std::atomic<long long> m_last_grow_us;  // 上次增加线程的时间
+    std::atomic<long long> m_last_dequeue_us; // 最近一次有线程取到任务的时间
+    std::atomic<long long> m_grows;         // 增加线程的次数
+    std::atomic<long long> m_shrinks;       // 回收线程的次数
+    locker m_grow_lock;          // 创建和回收线程时加锁
+    std::vector<int> m_cpus;     // 工作线程绑定的CPU，为空时不绑核，由m_grow_lock保护
+    worker_arg* m_worker_args;   // 每个线程槽位的启动参数
+    threadpool* m_db_lane;       // 数据库通道，为nullptr时所有请求都在本线程池处理
+    bool m_own_conns;            // 每个工作线程是否独占一个数据库连接
+    long long m_codel_target_us;   // CoDel目标排队时间，0表示不做过载保护
+    long long m_codel_interval_us; // CoDel观察间隔
+    locker m_codel_lock;           // 保护下面的CoDel状态，只有排队时间超标时才会加锁
+    std::atomic<long long> m_first_above_us; // 排队时间超标后再过一个间隔的时间点，0表示未超标
+    std::atomic<bool> m_dropping;  // 是否处于丢弃状态
+    long long m_drop_next_us;      // 下一次丢弃的时间点
+    int m_drop_count;              // 本轮丢弃状态中的丢弃次数
+    std::atomic<long long> m_shed; // 累计丢弃的任务数
+    work_steal_queue<task_item>** m_local_queues; // 工作窃取模式下每个线程槽位私有的任务队列
+    unsigned int m_next_queue;   // 外部线程投递任务时轮转选择的队列下标
+    static __thread threadpool* t_pool; // 当前线程所属的线程池，非工作线程为nullptr
+    static __thread int t_index;        // 当前线程在所属线程池中的编号
+    static __thread MYSQL* t_conn;      // 当前线程独占的数据库连接，未启用或还没取到时为nullptr
 };
 
+template <typename T>
+__thread threadpool<T>* threadpool<T>::t_pool = nullptr;
+
+template <typename T>
+__thread int threadpool<T>::t_index = -1;
+
+template <typename T>
+__thread MYSQL* threadpool<T>::t_conn = nullptr;
+
 // 模板类 threadpool 的构造函数
-// 目的：初始化线程池
+// 目的：初始化线程池，先创建thread_number个线程，其余槽位在排队时间过长时按需创建
 // 参数：
 // - actor_model: 指定线程池的工作模式
-// - connPool: 数据库连接池指针，本构造函数未直接使用，可能为其他成员函数所用
-// - thread_number: 线程池中线程的数量
-// - max_requests: 每个线程最大处理的请求数量
+// - connPool: 数据库连接池指针，工作线程处理请求时从中取连接
+// - thread_number: 线程数量下限，也是初始线程数
+// - max_requests: 请求队列中最多允许的，等待处理的请求数量
+// - sched_mode: 调度模式
+// - batch_size: 工作线程每次最多连续取出的任务数
+// - max_thread_number: 线程数量上限
 template <typename T>
-threadpool<T>::threadpool(int actor_model, connection_pool* connPool, int thread_number , int max_requests):m_actor_model(actor_model), m_thread_number(thread_number), m_max_requests(max_requests){
-    // 验证线程数量和最大请求数量的有效性
-    if (thread_number <= 0 || max_requests <= 0) {
+threadpool<T>::threadpool(int actor_model, connection_pool* connPool, int thread_number , int max_requests, int sched_mode, int batch_size, int max_thread_number):m_actor_model(actor_model), m_thread_number(thread_number), m_max_requests(max_requests), m_workqueue(max_requests), m_taskqueue(TASK_QUEUE_SIZE), m_stop(STOP_NONE), m_connPool(connPool), m_sched_mode(sched_mode), m_batch_size(batch_size), m_enqueue_calls(0), m_enqueued(0), m_cur_threads(0), m_last_grow_us(0), m_last_dequeue_us(0), m_grows(0), m_shrinks(0), m_db_lane(nullptr), m_own_conns(false), m_codel_target_us(0), m_codel_interval_us(100000), m_first_above_us(0), m_dropping(false), m_drop_next_us(0), m_drop_count(0), m_shed(0), m_local_queues(nullptr), m_next_queue(0){
+    // 验证线程数量、最大请求数量和批量大小的有效性
+    if (thread_number <= 0 || max_requests <= 0 || batch_size <= 0) {
         throw std::exception();
     }
-    // 分配线程池数组，用于存储线程的句柄
-    m_threads = new pthread_t[m_thread_number];
-    // 检查是否成功分配内存
-    if (!m_threads) {
+    m_max_thread_number = (max_thread_number > thread_number) ? max_thread_number : thread_number;
+
+    // 工作窃取模式下为每个线程槽位预分配一个队列，按下限线程数分摊max_requests
+    if (1 == m_sched_mode) {
+        int capacity = (max_requests + thread_number - 1) / thread_number;
+        m_local_queues = new work_steal_queue<task_item>*[m_max_thread_number];
+        for (int i = 0; i < m_max_thread_number; i++) {
+            m_local_queues[i] = new work_steal_queue<task_item>(capacity);
+        }
+    }
+    // 分配线程槽位数组，用于存储线程的句柄和启动参数
+    m_threads = new pthread_t[m_max_thread_number];
+    // worker_arg按缓存行对齐，C++17之前new不保证超过默认对齐的类型，用posix_memalign分配再逐个构造
+    void* args = nullptr;
+    if (posix_memalign(&args, alignof(worker_arg), sizeof(worker_arg) * m_max_thread_number) != 0) {
         throw std::exception();
     }
-    // 遍历创建每个线程
+    m_worker_args = (worker_arg*)args;
+    for (int i = 0; i < m_max_thread_number; i++) {
+        new (m_worker_args + i) worker_arg;
+        m_worker_args[i].pool = this;
+        m_worker_args[i].index = i;
+        m_worker_args[i].state = WORKER_FREE;
+        m_worker_args[i].dequeue_calls = 0;
+        m_worker_args[i].dequeued = 0;
+        m_worker_args[i].sleeps = 0;
+        m_worker_args[i].wait_total_us = 0;
+        m_worker_args[i].wait_max_us = 0;
+        m_worker_args[i].tasks = 0;
+    }
+    // 创建初始的工作线程
+    m_grow_lock.lock();
     for (int i = 0; i < thread_number; i++) {
-        // 创建工作线程，调用worker函数进行任务处理
-        if (pthread_create(m_threads + i, nullptr, worker, this) != 0) {
-            delete[] m_threads;
-            throw std::exception();
-        }
-
-        // 将线程设置为分离模式，这样线程结束时资源会自动回收
-        if (pthread_detach(m_threads[i])) {
-            delete[] m_threads;
+        if (!spawn_worker()) {
+            m_grow_lock.unlock();
             throw std::exception();
         }
     }
+    m_grow_lock.unlock();
 }
 
 // 销毁模板类threadpool的析构函数
 // 该析构函数负责释放线程池中所有线程的资源
 template <typename T>
 threadpool<T>::~threadpool() {
+    shutdown(false);
+    if (m_local_queues) {
+        for (int i = 0; i < m_max_thread_number; i++) {
+            delete m_local_queues[i];
+        }
+        delete[] m_local_queues;
+    }
+    for (int i = 0; i < m_max_thread_number; i++) {
+        m_worker_args[i].~worker_arg();
+    }
+    free(m_worker_args);
     delete[] m_threads;
 }
 
+// 关闭线程池
+// 在m_grow_lock内设置关闭状态，此后不会再有线程被创建或因空闲退出，槽位状态只会从RUNNING变为线程返回，
+// 所以这里是唯一的join者；唤醒所有睡眠的线程让它们看到关闭状态
+template <typename T>
+void threadpool<T>::shutdown(bool drain) {
+    m_grow_lock.lock();
+    if (STOP_NONE != m_stop.load(std::memory_order_relaxed)) {
+        m_grow_lock.unlock();
+        return;
+    }
+    m_stop.store(drain ? STOP_DRAIN : STOP_CANCEL, std::memory_order_release);
+    m_grow_lock.unlock();
+    m_queue_event.notify_all();
+
+    for (int i = 0; i < m_max_thread_number; i++) {
+        if (WORKER_FREE != m_worker_args[i].state.load(std::memory_order_acquire)) {
+            pthread_join(m_threads[i], nullptr);
+            m_worker_args[i].state.store(WORKER_FREE, std::memory_order_release);
+        }
+    }
+    m_cur_threads.store(0, std::memory_order_relaxed);
+
+    // 取消模式下释放队列中尚未执行的任务
+    threadpool_task task;
+    while (m_taskqueue.pop(task)) {
+        task.reset();
+    }
+}
+
 // 向线程池的工作队列中添加一个请求
 // @param request 待添加到工作队列的请求指针
 // @param state 请求的状态标识
 // @return 如果请求成功添加到工作队列，则返回true；否则返回false
 template <typename T>
 bool threadpool<T>::append(T* request, int state) {
-    m_queuelocker.lock(); // 加锁以保护工作队列
-    if (m_workqueue.size() >= m_max_requests) {
-        m_queuelocker.unlock(); // 解锁，避免阻塞其他线程
-        return false; // 工作队列已满，无法添加更多请求
-    }
-
     request->m_state = state; // 设置请求的状态
-    m_workqueue.push_back(request); // 将请求添加到工作队列
-    m_queuelocker.unlock(); // 解锁，释放对工作队列的保护
-    m_queuestat.post(); // 唤醒等待队列非空的线程
-    return true; // 请求成功添加到工作队列
+    return enqueue(request);
 }
 
 // 模板函数，向线程池中添加任务请求
 template <typename T>
 bool threadpool<T>::append_p(T* request) {
-    // 加锁以确保线程安全，在执行关键操作时防止多个线程同时访问
-    m_queuelocker.lock();
-    // 检查任务队列是否已满，如果达到最大请求数，则解锁并返回false
-    if (m_workqueue.size() >= m_max_requests) {
-        m_queuelocker.unlock();
+    return enqueue(request);
+}
+
+// 工作窃取模式下轮转选择一个正在运行的线程的队列
+// 线程数弹性变化时槽位不连续，跳过未运行的槽位；都不在运行时退回轮转到的槽位，任务会被其他线程窃取
+template <typename T>
+int threadpool<T>::pick_queue() {
+    unsigned int start = __sync_fetch_and_add(&m_next_queue, 1);
+    for (int i = 0; i < m_max_thread_number; i++) {
+        int index = (start + i) % m_max_thread_number;
+        if (WORKER_RUNNING == m_worker_args[index].state.load(std::memory_order_relaxed)) {
+            return index;
+        }
+    }
+    return start % m_max_thread_number;
+}
+
+// 将任务放入队列并唤醒一个工作线程
+// 共享队列模式下放入无锁环形队列；工作窃取模式下放入某个线程的私有队列：
+// 工作线程自己投递的任务放入自己的队列，外部线程（主线程）投递的任务轮转分配到各个队列
+// 只有存在睡眠中的线程时notify才会进入内核
+template <typename T>
+bool threadpool<T>::enqueue(T* request) {
+    if (m_stop.load(std::memory_order_acquire)) {
         return false;
     }
-    // 将任务请求添加到任务队列中
-    m_workqueue.push_back(request);
-    // 解锁以释放资源，避免长时间锁定导致的性能问题
-    m_queuelocker.unlock();
-    // 通知线程池有新的任务请求，用于唤醒等待的线程
-    m_queuestat.post();
-    return true; // 表示任务请求添加成功
+    long long now = now_us();
+    task_item item = {request, now};
+    if (1 == m_sched_mode) {
+        int start = (t_pool == this) ? t_index : pick_queue();
+        // 目标队列满了就依次尝试其他队列，全部满了才算失败
+        int i = 0;
+        for (; i < m_max_thread_number; i++) {
+            if (m_local_queues[(start + i) % m_max_thread_number]->push_back(item)) {
+                break;
+            }
+        }
+        if (i == m_max_thread_number) {
+            return false;
+        }
+    }
+    else if (!m_workqueue.push(item)) {
+        return false; // 工作队列已满，无法添加更多请求
+    }
+    m_enqueue_calls.fetch_add(1, std::memory_order_relaxed);
+    m_enqueued.fetch_add(1, std::memory_order_relaxed);
+    m_queue_event.notify_one(); // 唤醒一个空闲线程
+
+    // 积压的任务多于线程数，且已经有一段时间没有线程取到任务，说明线程都被卡住了
+    if (m_max_thread_number > m_thread_number && 0 == m_sched_mode &&
+        m_workqueue.size() >= (size_t)m_cur_threads.load(std::memory_order_relaxed)) {
+        maybe_grow(now - m_last_dequeue_us.load(std::memory_order_relaxed), now);
+    }
+    return true; // 请求成功添加到工作队列
+}
+
+// 批量添加任务请求
+// 共享队列模式下用一次CAS占下连续的多个槽位；工作窃取模式下轮转放入各线程的队列
+// 无论多少个任务，最后只唤醒一次，唤醒的线程数不超过任务数和线程数
+template <typename T>
+int threadpool<T>::append_batch(T** requests, const int* states, int n) {
+    if (states) {
+        for (int i = 0; i < n; i++) {
+            requests[i]->m_state = states[i];
+        }
+    }
+
+    if (m_stop.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    long long now = now_us();
+    int accepted = 0;
+    if (1 == m_sched_mode) {
+        for (; accepted < n; accepted++) {
+            task_item item = {requests[accepted], now};
+            int start = pick_queue();
+            int i = 0;
+            for (; i < m_max_thread_number; i++) {
+                if (m_local_queues[(start + i) % m_max_thread_number]->push_back(item)) {
+                    break;
+                }
+            }
+            if (i == m_max_thread_number) {
+                break;
+            }
+        }
+    }
+    else {
+        // 每次在栈上组装一段任务，环形队列在回绕处也可能需要分两次放入
+        const int CHUNK = 64;
+        task_item items[CHUNK];
+        while (accepted < n) {
+            int m = (n - accepted < CHUNK) ? n - accepted : CHUNK;
+            for (int i = 0; i < m; i++) {
+                items[i].request = requests[accepted + i];
+                items[i].enqueue_us = now;
+            }
+            size_t k = m_workqueue.push_batch(items, m);
+            if (0 == k) {
+                break;
+            }
+            accepted += (int)k;
+        }
+    }
+
+    if (accepted > 0) {
+        int threads = m_cur_threads.load(std::memory_order_relaxed);
+        m_enqueue_calls.fetch_add(1, std::memory_order_relaxed);
+        m_enqueued.fetch_add(accepted, std::memory_order_relaxed);
+        m_queue_event.notify_n(accepted < threads ? accepted : threads);
+
+        if (m_max_thread_number > m_thread_number && 0 == m_sched_mode &&
+            m_workqueue.size() >= (size_t)threads) {
+            maybe_grow(now - m_last_dequeue_us.load(std::memory_order_relaxed), now);
+        }
+    }
+    return accepted;
+}
+
+// 汇总各工作线程和队列的统计数据，数值是近似的快照
+template <typename T>
+void threadpool<T>::get_stats(threadpool_stats& stats) {
+    stats.enqueue_calls = m_enqueue_calls.load(std::memory_order_relaxed);
+    stats.enqueued = m_enqueued.load(std::memory_order_relaxed);
+    stats.dequeue_calls = 0;
+    stats.dequeued = 0;
+    stats.sleeps = 0;
+    stats.wait_total_us = 0;
+    stats.wait_max_us = 0;
+    for (int i = 0; i < m_max_thread_number; i++) {
+        worker_arg& w = m_worker_args[i];
+        stats.dequeue_calls += w.dequeue_calls.load(std::memory_order_relaxed);
+        stats.dequeued += w.dequeued.load(std::memory_order_relaxed);
+        stats.sleeps += w.sleeps.load(std::memory_order_relaxed);
+        stats.wait_total_us += w.wait_total_us.load(std::memory_order_relaxed);
+        long long max = w.wait_max_us.exchange(0, std::memory_order_relaxed);
+        if (max > stats.wait_max_us) {
+            stats.wait_max_us = max;
+        }
+    }
+    stats.wake_calls = m_queue_event.wake_calls();
+    stats.threads = m_cur_threads.load(std::memory_order_relaxed);
+    stats.min_threads = m_thread_number;
+    stats.max_threads = m_max_thread_number;
+    stats.grows = m_grows.load(std::memory_order_relaxed);
+    stats.shrinks = m_shrinks.load(std::memory_order_relaxed);
+    stats.shed = m_shed.load(std::memory_order_relaxed);
+    stats.tasks = 0;
+    for (int i = 0; i < m_max_thread_number; i++) {
+        stats.tasks += m_worker_args[i].tasks.load(std::memory_order_relaxed);
+    }
+    if (1 == m_sched_mode) {
+        stats.queue_depth = 0;
+        for (int i = 0; i < m_max_thread_number; i++) {
+            stats.queue_depth += m_local_queues[i]->size();
+        }
+    }
+    else {
+        stats.queue_depth = m_workqueue.size();
+    }
+}
+
+// 为当前线程取最多max个任务，没有任务时返回0
+// 只有队列积压时才批量取：每次取队列长度除以线程数个，这样负载低时任务仍然分散到各个线程，
+// 不会因为一个线程一次拿走多个任务而增加排队时间
+// 工作窃取模式下先取自己的队列（留一半给窃取者），再从随机位置开始依次窃取其他线程的队列
+template <typename T>
+int threadpool<T>::dequeue(int index, unsigned int& seed, task_item* items, int max) {
+    if (0 == m_sched_mode) {
+        // 线程数不加锁读取，关闭时会清零，至少按1个线程计算，避免除以0
+        int threads = m_cur_threads.load(std::memory_order_relaxed);
+        if (threads < 1) {
+            threads = 1;
+        }
+        size_t want = m_workqueue.size() / threads;
+        if (want < 1) {
+            want = 1;
+        }
+        if (want > (size_t)max) {
+            want = max;
+        }
+        return (int)m_workqueue.pop_batch(items, want);
+    }
+    int want = m_local_queues[index]->size() / 2;
+    if (want < 1) {
+        want = 1;
+    }
+    if (want > max) {
+        want = max;
+    }
+    int n = m_local_queues[index]->pop_front_batch(items, want);
+    if (n > 0) {
+        return n;
+    }
+    int start = rand_r(&seed) % m_max_thread_number;
+    for (int i = 0; i < m_max_thread_number; i++) {
+        int victim = (start + i) % m_max_thread_number;
+        if (victim == index || 0 == m_local_queues[victim]->size()) {
+            continue;
+        }
+        if (m_local_queues[victim]->steal_back(items[0])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 任务排队时间达到阈值且线程数未到上限时增加一个线程
+// 用m_last_grow_us的CAS保证同一时间段内只有一个线程去创建，每次只加一个
+template <typename T>
+void threadpool<T>::maybe_grow(long long wait_us, long long now) {
+    if (wait_us < GROW_WAIT_US || m_cur_threads.load(std::memory_order_relaxed) >= m_max_thread_number) {
+        return;
+    }
+    long long last = m_last_grow_us.load(std::memory_order_relaxed);
+    if (now - last < GROW_INTERVAL_US || !m_last_grow_us.compare_exchange_strong(last, now)) {
+        return;
+    }
+    m_grow_lock.lock();
+    if (STOP_NONE == m_stop.load(std::memory_order_relaxed) &&
+        m_cur_threads.load(std::memory_order_relaxed) < m_max_thread_number && spawn_worker()) {
+        m_grows.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_grow_lock.unlock();
+}
+
+// 在一个未运行的槽位上创建工作线程，已退出的线程先join回收
+// 调用者需持有m_grow_lock
+template <typename T>
+bool threadpool<T>::spawn_worker() {
+    for (int i = 0; i < m_max_thread_number; i++) {
+        worker_arg& w = m_worker_args[i];
+        int state = w.state.load(std::memory_order_acquire);
+        if (WORKER_RUNNING == state) {
+            continue;
+        }
+        if (WORKER_EXITED == state) {
+            pthread_join(m_threads[i], nullptr);
+        }
+        w.state.store(WORKER_RUNNING, std::memory_order_release);
+        m_cur_threads.fetch_add(1, std::memory_order_relaxed);
+        // 设置了绑核时在创建前就指定CPU，线程自己分配的内存从一开始就在本地节点
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (!m_cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(m_cpus[i % m_cpus.size()], &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        // 创建工作线程，调用worker函数进行任务处理
+        int ret = pthread_create(m_threads + i, &attr, worker, m_worker_args + i);
+        pthread_attr_destroy(&attr);
+        if (ret != 0) {
+            w.state.store(WORKER_FREE, std::memory_order_release);
+            m_cur_threads.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// 空闲超时后尝试退出当前线程
+// 先把线程数减一占住名额，工作窃取模式下自己的队列里还有任务则放弃退出；
+// 退出前顺便join其他已退出的线程，所以任何时候最多只有一个已退出的线程等待回收
+template <typename T>
+bool threadpool<T>::try_retire(int index) {
+    int cur = m_cur_threads.load(std::memory_order_relaxed);
+    while (cur > m_thread_number) {
+        if (!m_cur_threads.compare_exchange_weak(cur, cur - 1)) {
+            continue;
+        }
+        if (1 == m_sched_mode && m_local_queues[index]->size() > 0) {
+            m_cur_threads.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_grow_lock.lock();
+        // 线程池正在关闭，由shutdown负责join，不再自行退出
+        if (STOP_NONE != m_stop.load(std::memory_order_relaxed)) {
+            m_grow_lock.unlock();
+            m_cur_threads.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        for (int i = 0; i < m_max_thread_number; i++) {
+            if (i != index && WORKER_EXITED == m_worker_args[i].state.load(std::memory_order_acquire)) {
+                pthread_join(m_threads[i], nullptr);
+                m_worker_args[i].state.store(WORKER_FREE, std::memory_order_release);
+            }
+        }
+        m_worker_args[index].state.store(WORKER_EXITED, std::memory_order_release);
+        m_shrinks.fetch_add(1, std::memory_order_relaxed);
+        m_grow_lock.unlock();
+        return true;
+    }
+    return false;
 }
 
 // 线程池的工作函数，负责执行任务请求
 template <typename T>
 void* threadpool<T>::worker(void *arg) {
-    // 强制类型转换，将void指针转换为threadpool指针
-    threadpool *pool = (threadpool*)arg;
+    // 强制类型转换，取出所属线程池和线程编号
+    worker_arg* warg = (worker_arg*)arg;
+    threadpool *pool = warg->pool;
+    t_pool = pool;
+    t_index = warg->index;
     // 调用run函数执行任务请求
-    pool->run();
+    pool->run(warg->index);
+    // 退出前归还独占的连接
+    if (t_conn) {
+        pool->m_connPool->ReleaseConnection(t_conn);
+        t_conn = nullptr;
+    }
     // 返回线程池指针，通常用于调试或错误处理
     return pool;
 }
 
 // 模板函数，运行线程池的任务
 template <typename T>
-void threadpool<T>::run() {
-    // 循环等待并处理任务
+void threadpool<T>::run(int index) {
+    // 窃取时挑选目标队列用的随机数种子，每个线程独立
+    unsigned int seed = (unsigned int)(index * 2654435761u) ^ (unsigned int)pthread_self();
+    worker_arg& self = m_worker_args[index];
+    bool elastic = m_max_thread_number > m_thread_number;
+    std::vector<task_item> batch(m_batch_size);
+    threadpool_task task;
+    // 循环等待并处理任务，每轮取一批请求和至多一个通用任务，两者都不会饿死
     while (true) {
-        // 等待工作队列中有任务
-        m_queuestat.wait();
-        
-        // 加锁保护工作队列
-        m_queuelocker.lock();
-        
-        // 检查工作队列是否为空
-        if (m_workqueue.empty()) {
-            // 如果为空，解锁并继续下一轮循环
-            m_queuelocker.unlock();
-            continue;
+        int stop = m_stop.load(std::memory_order_acquire);
+        if (STOP_CANCEL == stop) {
+            return;
         }
-        
-        // 获取工作队列的第一个任务
-        T* request = m_workqueue.front();
-        
-        // 从工作队列中移除该任务
-        m_workqueue.pop_front();
-        
-        // 解锁工作队列
-        m_queuelocker.unlock();
-        
-        // 再次检查任务是否为空，为空则跳过
-        if (!request) {
+        int n = dequeue(index, seed, batch.data(), m_batch_size);
+        bool has_task = m_taskqueue.pop(task);
+
+        // 队列为空时先登记为等待者，再检查一次，仍然为空才睡眠，避免丢失唤醒
+        if (0 == n && !has_task) {
+            // 排空模式下队列已经空了，退出
+            if (STOP_DRAIN == stop) {
+                return;
+            }
+            unsigned int key = m_queue_event.prepare_wait();
+            n = dequeue(index, seed, batch.data(), m_batch_size);
+            has_task = m_taskqueue.pop(task);
+            if (n > 0 || has_task) {
+                m_queue_event.cancel_wait();
+            }
+            else if (m_stop.load(std::memory_order_acquire)) {
+                // 线程池正在关闭，回到循环开头处理
+                m_queue_event.cancel_wait();
+                continue;
+            }
+            else {
+                add_counter(self.sleeps, 1);
+                // 弹性模式下空闲超时且线程数高于下限时退出
+                if (elastic) {
+                    if (!m_queue_event.wait(key, IDLE_TIMEOUT_MS) && try_retire(index)) {
+                        return;
+                    }
+                }
+                else {
+                    m_queue_event.wait(key);
+                }
+                continue;
+            }
+        }
+
+        // 只有通用任务时直接执行，否则先处理请求
+        if (0 == n) {
+            run_task(self, task);
             continue;
         }
-        
-        // 根据actor模型的类型处理任务
-        if (1 == m_actor_model) {
-            // 待补充的处理逻辑
+
+        // 统计排队时间，最早入队的任务排队过久说明线程不够用
+        long long now = now_us();
+        long long oldest = 0;
+        for (int i = 0; i < n; i++) {
+            long long wait = now - batch[i].enqueue_us;
+            add_counter(self.wait_total_us, wait);
+            if (wait > oldest) {
+                oldest = wait;
+            }
+        }
+        if (oldest > self.wait_max_us.load(std::memory_order_relaxed)) {
+            self.wait_max_us.store(oldest, std::memory_order_relaxed);
+        }
+        add_counter(self.dequeue_calls, 1);
+        add_counter(self.dequeued, n);
+        if (elastic) {
+            if (now - m_last_dequeue_us.load(std::memory_order_relaxed) > 1000) {
+                m_last_dequeue_us.store(now, std::memory_order_relaxed);
+            }
+            maybe_grow(oldest, now);
+        }
+
+        for (int i = 0; i < n; i++) {
+            T* request = batch[i].request;
+            // 检查任务是否为空，为空则跳过
+            if (!request) {
+                continue;
+            }
+            // 只对新请求做过载判定，reactor模式下的写任务是已接受请求的后半段，不丢弃
+            bool shed = false;
+            if (m_codel_target_us > 0 && !(1 == m_actor_model && 1 == request->m_state)) {
+                size_t remaining = (1 == m_sched_mode) ? m_local_queues[index]->size() : m_workqueue.size();
+                shed = codel_should_drop(now - batch[i].enqueue_us, remaining + (n - 1 - i), now);
+            }
+            process_request(request, shed);
+        }
+        if (has_task) {
+            run_task(self, task);
         }
     }
 }
 
-#endif
+// 执行一个通用任务并立即释放它捕获的资源
+template <typename T>
+void threadpool<T>::run_task(worker_arg& self, threadpool_task& task) {
+    task();
+    task.reset();
+    add_counter(self.tasks, 1);
+}
 
+// 根据actor模型的类型处理任务
+// reactor模式下由工作线程完成读写，improv通知主线程本次读写已结束，timer_flag通知主线程关闭连接
+// proactor模式下主线程已完成读取，工作线程只负责解析请求和生成响应
+template <typename T>
+void threadpool<T>::process_request(T* request, bool shed) {
+    if (1 == m_actor_model) {
+        if (0 == request->m_state) {
+            // 被丢弃的请求也先读出来，这样关闭连接时不会因为有未读数据而发送RST，客户端能收到503
+            if (request->read_once()) {
+                request->improv = 1;
+                if (shed) {
+                    request->reply_busy();
+                }
+                else {
+                    process_parsed(request);
+                }
+            }
+            else {
+                request->improv = 1;
+                request->timer_flag = 1;
+            }
+        }
+        else {
+            if (request->write()) {
+                request->improv = 1;
+            }
+            else {
+                request->improv = 1;
+                request->timer_flag = 1;
+            }
+        }
+    }
+    else if (shed) {
+        request->reply_busy();
+    }
+    else {
+        process_parsed(request);
+    }
+}
 
+// CoDel：排队时间低于目标或队列已经排空时退出丢弃状态；
+// 持续超标一个间隔后进入丢弃状态并丢弃一个任务，之后每隔interval/sqrt(count)再丢弃一个，
+// 重新进入丢弃状态时如果距上次不久，沿用上次的丢弃频率
+template <typename T>
+bool threadpool<T>::codel_should_drop(long long sojourn_us, size_t remaining, long long now) {
+    if (sojourn_us < m_codel_target_us || 0 == remaining) {
+        if (m_first_above_us.load(std::memory_order_relaxed) || m_dropping.load(std::memory_order_relaxed)) {
+            m_codel_lock.lock();
+            m_first_above_us.store(0, std::memory_order_relaxed);
+            m_dropping.store(false, std::memory_order_relaxed);
+            m_codel_lock.unlock();
+        }
+        return false;
+    }
+
+    bool drop = false;
+    m_codel_lock.lock();
+    if (!m_dropping.load(std::memory_order_relaxed)) {
+        long long first_above = m_first_above_us.load(std::memory_order_relaxed);
+        if (0 == first_above) {
+            m_first_above_us.store(now + m_codel_interval_us, std::memory_order_relaxed);
+        }
+        else if (now >= first_above) {
+            drop = true;
+            m_dropping.store(true, std::memory_order_relaxed);
+            if (m_drop_count > 2 && now - m_drop_next_us < 8 * m_codel_interval_us) {
+                m_drop_count -= 2;
+            }
+            else {
+                m_drop_count = 1;
+            }
+            m_drop_next_us = now + (long long)(m_codel_interval_us / sqrt((double)m_drop_count));
+        }
+    }
+    else if (now >= m_drop_next_us) {
+        drop = true;
+        m_drop_count++;
+        m_drop_next_us += (long long)(m_codel_interval_us / sqrt((double)m_drop_count));
+    }
+    m_codel_lock.unlock();
+
+    if (drop) {
+        m_shed.fetch_add(1, std::memory_order_relaxed);
+    }
+    return drop;
+}
+
+// 设置了数据库通道时，需要数据库的请求转交过去；数据库通道已满则退回到本线程处理
+// 不分流时每个请求都取一个数据库连接；分流后只有需要数据库的请求才占用连接池
+// 没有连接池时（数据库操作由事件循环中的非阻塞连接执行）不取连接
+template <typename T>
+void threadpool<T>::process_parsed(T* request) {
+    if (!m_connPool) {
+        request->process();
+        return;
+    }
+    if (!m_db_lane) {
+        if (m_own_conns) {
+            process_owned(request);
+            return;
+        }
+        connectionRAII mysqlcon(&request->mysql, m_connPool);
+        request->process();
+        return;
+    }
+    if (request->is_db_request()) {
+        if (m_db_lane->append_p(request)) {
+            return;
+        }
+        // 连接都由数据库通道的线程独占且连接池不能再扩大，取不到连接，与队列满时一样回复503
+        if (m_db_lane->m_own_conns && !m_connPool->CanGrow()) {
+            request->reply_busy();
+            return;
+        }
+        connectionRAII mysqlcon(&request->mysql, m_connPool);
+        request->process();
+        return;
+    }
+    request->process();
+}
 
+template <typename T>
+void threadpool<T>::process_owned(T* request) {
+    if (!t_conn) {
+        t_conn = m_connPool->GetConnection();
+    }
+    else {
+        // 连接断开或空闲较久时在原处检查、重连，和从连接池取出时一样
+        m_connPool->CheckConnection(t_conn);
+    }
+    request->mysql = t_conn;
+    request->process();
+    request->mysql = nullptr;
+}
+
+#endif
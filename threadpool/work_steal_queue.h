@@ -0,0 +1,95 @@
+#ifndef WORK_STEAL_QUEUE_H
+#define WORK_STEAL_QUEUE_H
+
+#include <exception>
+#include "../lock/locker.h"
+
+// 工作窃取调度使用的每线程双端队列
+// 底层是构造时一次性分配好的环形数组，入队不再为每个任务分配链表节点
+// 所属线程从头部取任务（保持请求的到达顺序），其他线程从尾部窃取，两端分开以减少冲突
+// 每个队列各自一把锁，只有所属线程和偶尔出现的窃取者会竞争，不再是所有线程抢同一把锁
+template <typename T>
+class work_steal_queue {
+public:
+    // capacity: 队列容量，满了之后push_back返回false
+    work_steal_queue(int capacity = 1024) {
+        if (capacity <= 0) {
+            throw std::exception();
+        }
+        m_capacity = capacity;
+        m_array = new T[capacity];
+        m_head = 0;
+        m_size = 0;
+    }
+
+    ~work_steal_queue() {
+        delete[] m_array;
+    }
+
+    // 在尾部追加一个任务，队列已满返回false
+    bool push_back(const T& item) {
+        m_mutex.lock();
+        if (m_size >= m_capacity) {
+            m_mutex.unlock();
+            return false;
+        }
+        m_array[(m_head + m_size) % m_capacity] = item;
+        m_size++;
+        m_mutex.unlock();
+        return true;
+    }
+
+    // 所属线程从头部取出一个任务，队列为空返回false
+    bool pop_front(T& item) {
+        m_mutex.lock();
+        if (0 == m_size) {
+            m_mutex.unlock();
+            return false;
+        }
+        item = m_array[m_head];
+        m_head = (m_head + 1) % m_capacity;
+        m_size--;
+        m_mutex.unlock();
+        return true;
+    }
+
+    // 所属线程从头部一次取出最多max个任务，只加一次锁，返回取出的个数
+    int pop_front_batch(T* items, int max) {
+        m_mutex.lock();
+        int n = m_size < max ? m_size : max;
+        for (int i = 0; i < n; i++) {
+            items[i] = m_array[m_head];
+            m_head = (m_head + 1) % m_capacity;
+        }
+        m_size -= n;
+        m_mutex.unlock();
+        return n;
+    }
+
+    // 窃取者从尾部取走一个任务，队列为空返回false
+    bool steal_back(T& item) {
+        m_mutex.lock();
+        if (0 == m_size) {
+            m_mutex.unlock();
+            return false;
+        }
+        m_size--;
+        item = m_array[(m_head + m_size) % m_capacity];
+        m_mutex.unlock();
+        return true;
+    }
+
+    // 当前队列中的任务数，只作为窃取时挑选目标的参考，不加锁
+    int size() const {
+        return m_size;
+    }
+
+private:
+    locker m_mutex;  // 保护本队列的锁
+    T* m_array;      // 预分配的环形数组
+    int m_capacity;  // 队列容量
+    int m_head;      // 队首下标
+    volatile int m_size; // 当前任务数
+};
+
+#endif
@@ -319,6 +319,11 @@ void cb_func(client_data* user_data) {
     
     // 减少活动用户计数
     http_conn::m_user_count--;
+
+#ifdef ASYNC_DB
+    // 连接上可能还有等待中的数据库操作，结果到达时不再为已关闭的连接生成响应
+    user_data->conn->drop_pending_db();
+#endif
 }
 
 /**
@@ -8,12 +8,14 @@
 
 //连接资源结构体成员需要用到定时器类
 class util_timer;
+class http_conn;
 // 用于保存客户端相关数据的结构体
 struct client_data
 {
     sockaddr_in address;   // 客户端的socket地址
     int sockfd;            // socket文件描述符
     util_timer* timer;     // 指向定时器的指针
+    http_conn* conn;       // 对应的HTTP连接，定时器关闭连接时通知它
 };
 
 // 定时器类
@@ -1,7 +1,14 @@
 #include "webserver.h"
 
 WebServer::WebServer() {
-    users = new http_conn[MAX_FD];
+    // users和users_timer在init中绑核之后再分配，使它们按first-touch落在事件循环所在的NUMA节点
+    users = nullptr;
+    users_timer = nullptr;
+    m_db_pool = nullptr;
+    m_connPool = nullptr;
+#ifdef ASYNC_DB
+    m_async_db = nullptr;
+#endif
 
     char server_path[200];
     getcwd(server_path, 200);
@@ -9,8 +16,6 @@ WebServer::WebServer() {
     m_root = (char * )malloc(strlen(server_path) + strlen(root) + 1);
     strcpy(m_root, server_path);
     strcat(m_root, root);
-
-    users_timer = new client_data[MAX_FD];
 }
 
 WebServer::~WebServer() {
@@ -18,9 +23,14 @@ WebServer::~WebServer() {
     close(m_listenfd);
     close(m_pipefd[0]);
     close(m_pipefd[1]);
+    // 先停止线程池并等待工作线程退出，它们可能还在访问users
+    delete m_pool;
+    delete m_db_pool;
+#ifdef ASYNC_DB
+    delete m_async_db;
+#endif
     delete[] users;
     delete[] users_timer;
-    delete m_pool;
 
 }
 
@@ -38,23 +48,65 @@ WebServer::~WebServer() {
  * @param opt_linger 是否启用linger选项
  * @param trigmode 事件触发模式
  * @param sql_num 最大SQL连接数
+ * @param max_sql_num SQL连接数上限，0表示固定为sql_num
+ * @param user_cache 用户缓存的容量（用户数），0表示不限制
  * @param thread_num 线程池中的线程数量
  * @param close_log 是否关闭日志
  * @param actor_model 服务器的actor模型
+ * @param sched_mode 线程池调度模式
+ * @param batch_size 工作线程每次最多连续取出的任务数
+ * @param max_thread_num 线程池中的线程数上限
+ * @param codel_target 过载保护的目标排队时间（毫秒），0表示关闭
+ * @param cpu_list 绑核使用的CPU列表，如"0-7"，为空时不绑核
+ * @param log_full 异步日志缓冲区满时的处理方式，0阻塞等待，1丢弃并计数
+ * @param log_level 运行时日志级别，0为DEBUG到3为ERROR
+ * @param log_max_mb 单个日志文件的最大大小（MB），0表示不按大小分割
+ * @param log_ring_mb 内存映射环形日志文件的大小（MB），0表示默认的64MB
+ * @param log_keep 最多保留的已分割日志文件数，0表示不限制
+ * @param log_compress 是否在后台压缩分割出的旧日志文件
  */
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write,
-                    int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model) {
+                    int opt_linger, int trigmode, int sql_num, int max_sql_num, int user_cache, int thread_num, int close_log, int actor_model, int sched_mode, int batch_size, int max_thread_num, int codel_target, string cpu_list, int log_full, int log_level,
+                    int log_max_mb, int log_ring_mb, int log_keep, int log_compress) {
     m_port=  port;
     m_user=  user;
     m_passWord = passWord;
     m_databaseName = databaseName;
     m_sql_num = sql_num;
+    m_max_sql_num = max_sql_num;
+    m_user_cache = user_cache;
     m_thread_num = thread_num;
     m_log_write = log_write;
+    m_log_full = log_full;
+    m_log_level = log_level;
+    m_log_max_mb = log_max_mb;
+    m_log_ring_mb = log_ring_mb;
+    m_log_keep = log_keep;
+    m_log_compress = log_compress;
     m_OPT_LINGER = opt_linger;
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    m_sched_mode = sched_mode;
+    m_batch_size = batch_size;
+    m_max_thread_num = max_thread_num;
+    m_codel_target = codel_target;
+    m_rejected = 0;
+
+    // 第一个CPU给事件循环，先绑定主线程，再分配连接数组并由本线程写入每一页，页面落在本地节点。
+    // 只构造不会写到每一页（构造函数只写少数成员），之后第一次写入某个连接的可能是工作线程
+    m_cpus = parse_cpu_list(cpu_list);
+    if (!cpu_list.empty() && m_cpus.empty()) {
+        printf("invalid cpu list \"%s\", affinity disabled\n", cpu_list.c_str());
+    }
+    if (!m_cpus.empty() && !pin_current_thread(m_cpus[0])) {
+        printf("failed to pin event loop to cpu %d\n", m_cpus[0]);
+    }
+    users = new http_conn[MAX_FD];
+    users_timer = new client_data[MAX_FD];
+    touch_pages(users, sizeof(http_conn) * MAX_FD);
+    touch_pages(users_timer, sizeof(client_data) * MAX_FD);
+    m_batch_count = 0;
 }
 
 // 事件循环函数，处理所有事件，包括新客户端连接、读写事件等
@@ -85,6 +137,12 @@ void WebServer::eventLoop() {
                 if (false == flag) 
                     continue;
             }
+#ifdef ASYNC_DB
+            // 数据库连接可读写或有新提交的数据库操作
+            else if (m_async_db && m_async_db->owns(sockfd)) {
+                m_async_db->handle(sockfd, events[i].events);
+            }
+#endif
             // 如果事件为挂起读、连接关闭或错误，则处理对应的定时器
             else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 util_timer *timer = users_timer[sockfd].timer;
@@ -109,12 +167,82 @@ void WebServer::eventLoop() {
             }
 
         }
+        // 本轮收集到的读写请求一次性交给线程池
+        flush_batch();
+
         // 如果有超时发生，则处理定时器，并记录信息
         if (timeout) {
             utils.timer_handler();
 
             LOG_INFO("%s", "timer tick");
 
+            // 记录线程池统计，平均每次入队/出队的任务数和唤醒次数反映批量处理的效果
+            threadpool_stats st;
+            m_pool->get_stats(st);
+            LOG_INFO("threadpool: enqueue %lld/%lld calls, dequeue %lld/%lld calls, sleeps %lld, wakeups %lld",
+                     st.enqueued, st.enqueue_calls, st.dequeued, st.dequeue_calls, st.sleeps, st.wake_calls);
+            // 线程数和排队时间反映弹性伸缩的效果
+            LOG_INFO("threadpool: threads %d [%d, %d], grows %lld, shrinks %lld, queue depth %lld, wait avg %lldus max %lldus",
+                     st.threads, st.min_threads, st.max_threads, st.grows, st.shrinks, st.queue_depth,
+                     st.dequeued ? st.wait_total_us / st.dequeued : 0, st.wait_max_us);
+            long long shed = st.shed;
+            long long db_shed = 0;
+            // 数据库通道的排队情况，与上面对比可以看出数据库变慢时静态请求是否受影响
+            if (m_db_pool) {
+                m_db_pool->get_stats(st);
+                LOG_INFO("db lane: threads %d, dequeued %lld, queue depth %lld, wait avg %lldus max %lldus",
+                         st.threads, st.dequeued, st.queue_depth,
+                         st.dequeued ? st.wait_total_us / st.dequeued : 0, st.wait_max_us);
+                db_shed = st.shed;
+            }
+            // 数据库连接池：等待取连接的次数和时间反映连接数是否够用，ping失败和重连反映数据库的可用性
+            if (m_connPool) {
+                connection_pool_stats pool_st;
+                m_connPool->get_stats(pool_st);
+                LOG_INFO("sql pool: conns %d free %d [%d, %d], acquires %lld, waits %lld, wait avg %lldus max %lldus, timeouts %lld",
+                         pool_st.total, pool_st.free, pool_st.min_conns, pool_st.max_conns, pool_st.acquires, pool_st.waits,
+                         pool_st.waits ? pool_st.wait_total_us / pool_st.waits : 0, pool_st.wait_max_us, pool_st.timeouts);
+                LOG_INFO("sql pool: grows %lld, shrinks %lld, ping failures %lld, reconnects %lld (failed %lld)",
+                         pool_st.grows, pool_st.shrinks, pool_st.ping_failures, pool_st.reconnects, pool_st.reconnect_failures);
+                // 合并注册：每批的平均用户数反映合并的效果
+                group_commit_stats insert_st;
+                http_conn::get_insert_stats(insert_st);
+                LOG_INFO("register inserts: %lld users in %lld batches (avg %.1f, max %d), failed %lld",
+                         insert_st.rows, insert_st.batches, insert_st.batches ? (double)insert_st.rows / insert_st.batches : 0.0,
+                         insert_st.max_batch, insert_st.failed);
+            }
+            // 用户缓存：命中率反映容量是否够用，内存只随容量变化
+            user_cache_stats cache_st;
+            http_conn::get_cache_stats(cache_st);
+            LOG_INFO("user cache: users %zu/%zu, %zu KB, hits %lld, absent hits %lld, misses %lld (expired %lld), evictions %lld",
+                     cache_st.users, cache_st.capacity, cache_st.memory / 1024, cache_st.hits, cache_st.absent_hits,
+                     cache_st.misses, cache_st.expired, cache_st.evictions);
+            // 用户名过滤器：误判多说明用户数已超过设计容量，要等下一次重建
+            user_filter_stats filter_st;
+            http_conn::get_filter_stats(filter_st);
+            LOG_INFO("user filter: %s, users %lld/%zu, %zu KB, built %lld times (last %lld ms), checks %lld, no db %lld, false positives %lld",
+                     filter_st.ready ? "ready" : "building", filter_st.users, filter_st.capacity, filter_st.memory / 1024,
+                     filter_st.builds, filter_st.build_ms, filter_st.checks, filter_st.negatives, filter_st.false_positives);
+#ifdef ASYNC_DB
+            // 挂起等待数据库的请求数：正在执行的和等待空闲连接的
+            sql_async_stats db_st;
+            m_async_db->get_stats(db_st);
+            LOG_INFO("async db: conns %d, busy %d, queued %d, done %lld, failed %lld, reconnects %lld (failed %lld)",
+                     db_st.conns, db_st.busy, db_st.queued, db_st.done, db_st.failed,
+                     db_st.reconnects, db_st.reconnect_failures);
+            LOG_INFO("register inserts: %lld users in %lld merged inserts (avg %.1f)",
+                     db_st.batched, db_st.batches, db_st.batches ? (double)db_st.batched / db_st.batches : 0.0);
+#endif
+            // 过载丢弃：队列满被拒绝的请求，以及因排队过久被丢弃的请求（主线程池/数据库通道）
+            LOG_INFO("overload: rejected %lld (queue full), shed %lld/%lld (queue delay)", m_rejected, shed, db_shed);
+            if (0 == m_close_log && Log::get_instance()->dropped() > 0) {
+                LOG_INFO("log: dropped %lld lines", Log::get_instance()->dropped());
+            }
+            // 日志按时间间隔在写日志时刷新，空闲时由这里把最后几行写入文件
+            if (0 == m_close_log) {
+                Log::get_instance()->flush();
+            }
+
             timeout = false;
         }
     }
@@ -172,11 +300,18 @@ void WebServer::eventListen() {
     assert(ret != -1); // 确保管道创建成功
     utils.setnonblocking(m_pipefd[1]);
     utils.addfd(m_epollfd, m_pipefd[0], false, 0);
+#ifdef ASYNC_DB
+    // 数据库连接和提交操作用的eventfd也由事件循环监听
+    m_async_db->attach(m_epollfd);
+#endif
 
     // 添加信号处理
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    // 运行中调整日志级别：SIGUSR1输出更多（降低一级），SIGUSR2输出更少（提高一级）
+    utils.addsig(SIGUSR1, utils.sig_handler, false);
+    utils.addsig(SIGUSR2, utils.sig_handler, false);
 
     // 设置定时器
     alarm(TIMESLOT);
@@ -193,41 +328,123 @@ void WebServer::eventListen() {
  */
 void WebServer::log_write() {
     if (0 == m_close_log) {
-        //初始化日志
+        //初始化日志，分割策略要在打开文件前设置；环形文件不分割，大小由-M指定
+        long long max_mb = 5 == m_log_write ? m_log_ring_mb : m_log_max_mb;
+        Log::get_instance()->set_rotation_policy(max_mb << 20, m_log_keep, 0 != m_log_compress);
         if (1 == m_log_write) {
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
+            // 异步写日志线程放在列表中的最后一个CPU上，列表只有一个CPU时与事件循环共用
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800, m_cpus.empty() ? -1 : m_cpus.back(),
+                                      Log::LOG_MODE_ASYNC, 1 == m_log_full ? log_ring::FULL_DROP : log_ring::FULL_BLOCK);
+        }
+        else if (2 == m_log_write) {
+            // 每线程缓冲，后台线程放在列表中的最后一个CPU上
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0, m_cpus.empty() ? -1 : m_cpus.back(), Log::LOG_MODE_BUFFERED);
+        }
+        else if (3 == m_log_write || 4 == m_log_write) {
+            // 延迟格式化，二进制模式写出的日志用log_decode查看
+            Log::get_instance()->init(3 == m_log_write ? "./ServerLog" : "./ServerLog.bin", m_close_log, 2000, 800000, 800,
+                                      m_cpus.empty() ? -1 : m_cpus.back(),
+                                      3 == m_log_write ? Log::LOG_MODE_DEFERRED : Log::LOG_MODE_BINARY,
+                                      1 == m_log_full ? log_ring::FULL_DROP : log_ring::FULL_BLOCK);
+        }
+        else if (5 == m_log_write) {
+            // 内存映射环形文件，-M指定文件大小，用log_dump查看
+            Log::get_instance()->init("./ServerLog.ring", m_close_log, 2000, 800000, 0, -1, Log::LOG_MODE_MMAP);
         }
         else {
             Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
         }
+        Log::get_instance()->set_level(m_log_level);
     }
 }
 
 /**
- * 初始化数据库连接池和用户表
+ * 初始化数据库连接池和用户缓存
  * 
- * 本函数负责初始化数据库连接池和用户表，以确保Web服务器能够正常地与数据库交互
- * 首先，它创建并配置了一个数据库连接池，然后，它初始化了一个用户表，该表将使用数据库连接池进行操作
+ * 本函数负责初始化数据库连接池和用户缓存，以确保Web服务器能够正常地与数据库交互
+ * 首先，它创建并配置了一个数据库连接池，然后设置用户缓存的容量，用户在登录时按需查询数据库后放入缓存，
+ * 最后在后台建立用户名过滤器
  * 
  * 参数：
  * - m_user: 数据库用户名
  * - m_passWord: 数据库用户密码
  * - m_databaseName: 要连接的数据库名称
  * - m_sql_num: 数据库连接池中的初始连接数量
+ * - m_max_sql_num: 数据库连接池中的连接数上限
+ * - m_user_cache: 用户缓存的容量
  * - m_close_log: 是否关闭日志功能的标志
  */
 void WebServer::sql_pool() {
+#ifdef ASYNC_DB
+    // 登录、注册由事件循环中的非阻塞连接完成，不需要连接池
+    m_async_db = new sql_async<http_conn>(m_close_log);
+    m_async_db->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num);
+    http_conn::m_async_db = m_async_db;
+#else
     // 初始化数据库连接池
     m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log, m_max_sql_num);
+#endif
 
-    // 初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    // 不在启动时加载用户表，用户在登录时按需查询，缓存的用户数不超过m_user_cache
+    http_conn::init_cache(m_user_cache);
+    // 后台读取用户名建立过滤器，注册时据此判断是否需要查询数据库确认用户名没有被占用
+    http_conn::init_filter("localhost", m_user, m_passWord, m_databaseName, 3306, m_close_log);
 }
 
 void WebServer::thread_pool() {
+#ifdef ASYNC_DB
+    // 数据库操作提交给事件循环后请求即挂起，工作线程不取连接，也不需要单独的数据库通道
+    m_pool = new threadpool<http_conn>(m_actormodel, nullptr, m_thread_num, 10000, m_sched_mode, m_batch_size, m_max_thread_num);
+#else
     // 线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num, 10000, m_sched_mode, m_batch_size, m_max_thread_num);
+    // 数据库通道，线程数等于连接数，每个线程总能拿到连接；读写仍由上面的线程池或主线程完成，所以按proactor方式只做解析和响应
+    // 连接数可以增长时线程数也随排队情况在[m_sql_num, m_max_sql_num]之间变化，等待连接时连接池新建连接
+    m_db_pool = new threadpool<http_conn>(0, m_connPool, m_sql_num, 10000, 0, 1, m_max_sql_num);
+    m_pool->set_db_lane(m_db_pool);
+    // 线程数与连接数相同，每个线程独占一个连接，取放连接不再加锁
+    if (m_db_pool->set_thread_conns()) {
+        LOG_INFO("db lane: each of %d threads owns a connection", m_sql_num);
+    }
+    m_db_pool->set_codel(m_codel_target);
+#endif
+    // 按排队时间做过载保护，排队过久的请求直接回复503
+    m_pool->set_codel(m_codel_target);
+
+    // 工作线程使用事件循环之外的CPU，主线程池在前，数据库通道接着往后排
+    if (!m_cpus.empty()) {
+        std::vector<int> worker_cpus(m_cpus.size() > 1 ? m_cpus.begin() + 1 : m_cpus.begin(), m_cpus.end());
+        std::vector<int> db_cpus(worker_cpus.size());
+        for (size_t i = 0; i < worker_cpus.size(); i++) {
+            db_cpus[i] = worker_cpus[(i + m_thread_num) % worker_cpus.size()];
+        }
+        if (!m_pool->set_affinity(worker_cpus) || (m_db_pool && !m_db_pool->set_affinity(db_cpus))) {
+            printf("failed to pin some worker threads\n");
+        }
+    }
+    report_placement();
+}
+
+// 启动时输出绑核和内存所在节点，方便在多路服务器上确认布局
+void WebServer::report_placement() {
+    if (m_cpus.empty()) {
+        printf("placement: affinity disabled, event loop on cpu %d (node %d), users[] on node %d\n",
+               sched_getcpu(), cpu_to_node(sched_getcpu()), page_node(users));
+        return;
+    }
+    std::vector<int> worker_cpus(m_cpus.size() > 1 ? m_cpus.begin() + 1 : m_cpus.begin(), m_cpus.end());
+    printf("placement: event loop cpu %d (node %d), users[] on node %d, users_timer[] on node %d\n",
+           m_cpus[0], cpu_to_node(m_cpus[0]), page_node(users), page_node(users_timer));
+    if (0 == m_close_log && 0 != m_log_write) {
+        printf("placement: log thread cpu %d (node %d)\n", m_cpus.back(), cpu_to_node(m_cpus.back()));
+    }
+    int workers = m_thread_num + (m_db_pool ? m_sql_num : 0);
+    for (int i = 0; i < workers; i++) {
+        int cpu = worker_cpus[i % worker_cpus.size()];
+        printf("placement: %s worker %d cpu %d (node %d)\n", i < m_thread_num ? "pool" : "db lane",
+               i < m_thread_num ? i : i - m_thread_num, cpu, cpu_to_node(cpu));
+    }
 }
 
 /**
@@ -340,8 +557,24 @@ void WebServer::deal_timer(util_timer *timer, int sockfd) {
         utils.m_timer_lst.del_timer(timer);
     }
     
-    // 记录日志，说明已经关闭了相应的socket描述符
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    // 记录日志，说明已经关闭了相应的socket描述符，每个连接都会经过这里，采样记录
+    LOG_INFO_SAMPLED(100, "close fd %d", users_timer[sockfd].sockfd);
+}
+
+/**
+ * 处理被线程池拒绝的请求
+ * 
+ * 线程池队列已满时append会返回false，此时立即告知客户端服务器繁忙并关闭连接，
+ * 而不是让连接一直挂起直到定时器超时
+ * 
+ * @param timer 与该客户端连接相关的定时器对象
+ * @param sockfd 客户端的socket描述符
+ */
+void WebServer::deal_overload(util_timer *timer, int sockfd) {
+    send(sockfd, http_conn::BUSY_RESPONSE, http_conn::BUSY_RESPONSE_LEN, 0);
+    // 过载时每个请求都写日志只会加重负担，只计数，在定时器里汇总输出
+    m_rejected++;
+    deal_timer(timer, sockfd);
 }
 
 bool WebServer::dealwithsignal(bool &timeout, bool &stop_server) {
@@ -367,6 +600,17 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server) {
                 stop_server = true;
                 break;
             }
+            case SIGUSR1:
+            case SIGUSR2: {
+                if (0 == m_close_log) {
+                    static const char* names[] = {"debug", "info", "warn", "error"};
+                    Log* log = Log::get_instance();
+                    log->set_level(log->get_level() + (SIGUSR1 == signals[i] ? -1 : 1));
+                    // 直接调用write_log，不受级别过滤，保证级别变化总能留下记录
+                    log->write_log(LOG_LEVEL_WARN, "log level set to %s", names[log->get_level()]);
+                }
+                break;
+            }
             }
         }
     }
@@ -385,8 +629,8 @@ void WebServer::adjust_timer(util_timer* timer) {
     timer->expire = cur + 3* TIMESLOT;
     // 调整定时器列表中的定时器
     utils.m_timer_lst.adjust_timer(timer);
-    // 记录调整定时器的日志
-    LOG_INFO("%s", "adjust timer once ");
+    // 记录调整定时器的日志，每个请求都会经过这里，采样记录
+    LOG_INFO_SAMPLED(100, "%s", "adjust timer once ");
 }
 
 // 处理读事件的函数
@@ -402,34 +646,31 @@ void WebServer::dealwithread(int sockfd) {
             adjust_timer(timer);
         }
 
-        // 将读事件放入请求队列
-        m_pool->append(users + sockfd, 0);
-
-        // 循环检查是否有立即处理的请求
-        while (true) {
-            // 如果存在立即处理的请求
-            if (1 == users[sockfd].improv) {
-                // 如果设置了定时器标志位，则处理定时器
-                if (1 == users[sockfd].timer_flag) {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                // 清除立即处理标志位
-                users[sockfd].improv = 0;
-                // 退出循环
-                break;
-            }
-        }
+        // 将读事件记入本轮的批量请求，事件处理完后统一交给线程池
+        m_batch_fds[m_batch_count] = sockfd;
+        m_batch_states[m_batch_count] = 0;
+        m_batch_count++;
     }
     else {
         // 如果是proactor模型
         // 如果成功读取一次
         if (users[sockfd].read_once()) {
-            // 记录日志
-            LOG_INFO("deal with the client(%s)",inet_ntoa(users[sockfd].get_address()->sin_addr));
-            // 将读事件放入请求队列
-            m_pool->append_p(users + sockfd);
-        
+            // 记录日志，采样记录；inet_ntoa返回静态缓冲区不是线程安全的，改用inet_ntop，只在真正记录时才转换
+            char ip[INET_ADDRSTRLEN];
+            LOG_INFO_SAMPLED(100, "deal with the client(%s)", inet_ntop(AF_INET, &users[sockfd].get_address()->sin_addr, ip, sizeof(ip)));
+            // 需要数据库的请求直接交给数据库通道，队列已满则拒绝
+            if (m_db_pool && users[sockfd].is_db_request()) {
+                if (!m_db_pool->append_p(users + sockfd)) {
+                    deal_overload(timer, sockfd);
+                    return;
+                }
+            }
+            else {
+                // 将请求记入本轮的批量请求，事件处理完后统一交给线程池
+                m_batch_fds[m_batch_count] = sockfd;
+                m_batch_states[m_batch_count] = 0;
+                m_batch_count++;
+            }
 
             // 如果定时器存在，则调整定时器
             if (timer) {
@@ -457,31 +698,18 @@ void WebServer::dealwithwrite(int sockfd) {
             adjust_timer(timer);
         }
 
-        // 将请求加入到线程池处理
-        m_pool->append(users + sockfd, 1);
-
-        // 循环等待直到当前连接的写事件处理完成
-        while(true) {
-            // 如果当前连接有写事件需要处理
-            if (1 == users[sockfd].improv) {
-                // 如果设置了定时器标记，则处理定时器
-                if (1 == users[sockfd].timer_flag) {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                // 标记当前连接的写事件已处理
-                users[sockfd].improv = 0;
-                // 跳出循环
-                break;
-            }
-        }
+        // 将写事件记入本轮的批量请求，事件处理完后统一交给线程池
+        m_batch_fds[m_batch_count] = sockfd;
+        m_batch_states[m_batch_count] = 1;
+        m_batch_count++;
     }
     else {
         // 如果是proactor模型
         // 如果写事件处理成功
         if (users[sockfd].write()) {
-            // 记录日志，表示数据发送成功
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            // 记录日志，表示数据发送成功，采样记录
+            char ip[INET_ADDRSTRLEN];
+            LOG_INFO_SAMPLED(100, "send data to the client(%s)", inet_ntop(AF_INET, &users[sockfd].get_address()->sin_addr, ip, sizeof(ip)));
 
             // 如果定时器存在，则调整定时器
             if (timer) {
@@ -495,6 +723,46 @@ void WebServer::dealwithwrite(int sockfd) {
     }
 }
 
+/**
+ * 把本轮epoll_wait收集到的读写请求一次性交给线程池
+ * 
+ * 整批请求只做一次入队操作和一次唤醒，队列放不下的请求直接拒绝。
+ * reactor模式下随后依次等待工作线程完成每个连接本次的读写，
+ * 读写失败的连接由主线程关闭并删除定时器。
+ */
+void WebServer::flush_batch() {
+    if (0 == m_batch_count) {
+        return;
+    }
+
+    for (int i = 0; i < m_batch_count; i++) {
+        m_batch_conns[i] = users + m_batch_fds[i];
+    }
+    int accepted = m_pool->append_batch(m_batch_conns, (1 == m_actormodel) ? m_batch_states : nullptr, m_batch_count);
+
+    // 队列已满，放不下的请求直接拒绝
+    for (int i = accepted; i < m_batch_count; i++) {
+        deal_overload(users_timer[m_batch_fds[i]].timer, m_batch_fds[i]);
+    }
+
+    if (1 == m_actormodel) {
+        for (int i = 0; i < accepted; i++) {
+            int sockfd = m_batch_fds[i];
+            // 等待工作线程完成该连接本次的读写
+            while (1 != users[sockfd].improv) {
+            }
+            // 如果设置了定时器标志位，则处理定时器
+            if (1 == users[sockfd].timer_flag) {
+                deal_timer(users_timer[sockfd].timer, sockfd);
+                users[sockfd].timer_flag = 0;
+            }
+            // 清除立即处理标志位
+            users[sockfd].improv = 0;
+        }
+    }
+    m_batch_count = 0;
+}
+
 // 为新建立连接的客户端设置定时器
 void WebServer::timer(int connfd, struct sockaddr_in client_address)
 {
@@ -504,6 +772,7 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
     // 初始化与客户端相关的定时器数据
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
+    users_timer[connfd].conn = &users[connfd];
 
     // 创建新的定时器实例，并设置定时器的回调函数、超时时间及用户数据
     util_timer *timer = new util_timer;
@@ -40,16 +40,34 @@ public:
      * @param opt_linger 是否启用OPT_LINGER
      * @param trigmode 事件触发模式
      * @param sql_num SQL连接池中的连接数
+     * @param max_sql_num SQL连接池中的连接数上限，0表示固定为sql_num
+     * @param user_cache 用户缓存的容量（用户数），0表示不限制
      * @param thread_num 线程池中的线程数
      * @param close_log 是否关闭日志写入
      * @param actor_model 演员模型模式
+     * @param sched_mode 线程池调度模式
+     * @param batch_size 工作线程每次最多连续取出的任务数
+     * @param max_thread_num 线程池中的线程数上限
+     * @param codel_target 过载保护的目标排队时间（毫秒），0表示关闭
+     * @param cpu_list 绑核使用的CPU列表，如"0-7"，为空时不绑核
+     * @param log_full 异步日志缓冲区满时的处理方式，0阻塞等待，1丢弃并计数
+     * @param log_level 运行时日志级别，0为DEBUG到3为ERROR
+     * @param log_max_mb 单个日志文件的最大大小（MB），0表示不按大小分割
+     * @param log_ring_mb 内存映射环形日志文件的大小（MB），0表示默认的64MB
+ * @param log_ring_mb 内存映射环形日志文件的大小（MB），0表示默认的64MB
+     * @param log_keep 最多保留的已分割日志文件数，0表示不限制
+     * @param log_compress 是否在后台压缩分割出的旧日志文件
      */
     void init(int port, string user, string passwd, string databaseName,
-            int log_write, int opt_linger, int trigmode, int sql_num,
-            int thread_num, int close_log, int actor_model);
+            int log_write, int opt_linger, int trigmode, int sql_num, int max_sql_num, int user_cache,
+            int thread_num, int close_log, int actor_model, int sched_mode, int batch_size, int max_thread_num, int codel_target, string cpu_list, int log_full, int log_level,
+                    int log_max_mb, int log_ring_mb, int log_keep, int log_compress);
 
     // 线程池初始化函数
     void thread_pool();
+
+    // 启动时输出事件循环、日志线程和工作线程绑定的CPU以及连接数组所在的NUMA节点
+    void report_placement();
     
     // SQL连接池初始化函数
     void sql_pool();
@@ -82,6 +100,13 @@ public:
      * @param sockfd 客户端连接文件描述符
      */
     void deal_timer(util_timer *timer, int sockfd);
+
+    /**
+     * 线程池队列已满时拒绝请求，告知客户端服务器繁忙并关闭连接
+     * @param timer 定时器对象
+     * @param sockfd 客户端连接文件描述符
+     */
+    void deal_overload(util_timer *timer, int sockfd);
     
     // 处理客户端数据函数
     bool dealclientdata();
@@ -100,6 +125,9 @@ public:
     // 处理写事件函数
     void dealwithwrite(int sockfd);
 
+    // 把本轮epoll_wait收集到的请求一次性交给线程池
+    void flush_batch();
+
 public:
     // 服务器监听端口
     int m_port;
@@ -107,6 +135,18 @@ public:
     char* m_root;
     // 日志写入模式
     int m_log_write;
+    // 异步日志缓冲区满时的处理方式
+    int m_log_full;
+    // 运行时日志级别
+    int m_log_level;
+    // 单个日志文件的最大大小（MB）
+    int m_log_max_mb;
+    // 内存映射环形日志文件的大小（MB）
+    int m_log_ring_mb;
+    // 最多保留的已分割日志文件数
+    int m_log_keep;
+    // 是否压缩分割出的旧日志文件
+    int m_log_compress;
     // 是否关闭日志写入
     int m_close_log;
     // 演员模型模式
@@ -129,11 +169,39 @@ public:
     string m_databaseName;
     // SQL连接池中的连接数
     int m_sql_num;
+    // SQL连接池中的连接数上限
+    int m_max_sql_num;
+    // 用户缓存的容量
+    int m_user_cache;
+#ifdef ASYNC_DB
+    // 事件循环中的非阻塞数据库客户端，连接数为m_sql_num
+    sql_async<http_conn>* m_async_db;
+#endif
 
-    // 线程池指针
+    // 线程池指针，处理静态文件等不访问数据库的请求
     threadpool<http_conn> *m_pool;
+    // 数据库通道线程池，只处理登录、注册等需要数据库的请求，线程数与数据库连接数相同
+    threadpool<http_conn> *m_db_pool;
     // 线程池中的线程数
     int m_thread_num;
+    // 线程池调度模式
+    int m_sched_mode;
+    // 工作线程每次最多连续取出的任务数
+    int m_batch_size;
+    // 线程池中的线程数上限
+    int m_max_thread_num;
+    // 过载保护的目标排队时间（毫秒）
+    int m_codel_target;
+    // 因任务队列已满被拒绝的请求数
+    long long m_rejected;
+    // 绑核使用的CPU，第一个给事件循环，其余给工作线程，为空时不绑核
+    std::vector<int> m_cpus;
+
+    // 本轮epoll_wait中等待交给线程池的连接、状态和个数
+    int m_batch_fds[MAX_EVENT_NUMBER];
+    int m_batch_states[MAX_EVENT_NUMBER];
+    http_conn* m_batch_conns[MAX_EVENT_NUMBER];
+    int m_batch_count;
 
     // epoll事件数组
     epoll_event events[MAX_EVENT_NUMBER];